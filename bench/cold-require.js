@@ -0,0 +1,57 @@
+// Copyright 2026 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the cold require time of the agent, the cost paid on the
+// startup path of every application loading it with --require. Each
+// iteration spawns a fresh node process so nothing is warm in the module
+// cache. Run after `npm run compile`:
+//
+//   node bench/cold-require.js
+
+'use strict';
+
+const {execFileSync} = require('child_process');
+const path = require('path');
+
+const ITERATIONS = 10;
+
+const agentPath = path.join(__dirname, '..', 'build', 'src', 'index.js');
+const script =
+  'const start = process.hrtime.bigint();' +
+  `require(${JSON.stringify(agentPath)});` +
+  'const end = process.hrtime.bigint();' +
+  'console.log(Number(end - start) / 1e6);';
+
+function main() {
+  const millis = [];
+  for (let i = 0; i < ITERATIONS; i++) {
+    const out = execFileSync(process.execPath, ['-e', script], {
+      encoding: 'utf8',
+    });
+    millis.push(Number(out.trim()));
+  }
+  millis.sort((a, b) => a - b);
+  const mean = millis.reduce((a, b) => a + b, 0) / millis.length;
+  console.log(
+    JSON.stringify({
+      iterations: ITERATIONS,
+      minMillis: Number(millis[0].toFixed(2)),
+      medianMillis: Number(millis[Math.floor(millis.length / 2)].toFixed(2)),
+      meanMillis: Number(mean.toFixed(2)),
+      maxMillis: Number(millis[millis.length - 1].toFixed(2)),
+    })
+  );
+}
+
+main();
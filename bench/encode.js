@@ -0,0 +1,193 @@
+// Copyright 2026 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Micro-benchmark for the agent's serialization path: the time profile
+// fixture from test/profiles-for-tests.ts is scaled up to a
+// production-sized sample count, then proto encoding (generated and
+// incremental encoders), gzip at several levels, and the end-to-end
+// encode+gzip+base64 step are measured. Output is one JSON object, so
+// runs across Node versions or encode-pipeline changes can be diffed.
+//
+// Run after `npm run compile`:
+//
+//   node bench/encode.js [sampleCount]
+
+'use strict';
+
+const path = require('path');
+const zlib = require('zlib');
+
+const {perftools} = require(path.join(__dirname, '..', 'protos', 'profile'));
+const {ProfileEncoder} = require(path.join(
+  __dirname,
+  '..',
+  'build',
+  'src',
+  'profile-encoder'
+));
+const {timeProfile} = require(path.join(
+  __dirname,
+  '..',
+  'build',
+  'test',
+  'profiles-for-tests'
+));
+
+const DEFAULT_SAMPLE_COUNT = 10000;
+const ITERATIONS = 20;
+const GZIP_LEVELS = [1, 6, 9];
+
+// Scales the fixture up: every location/function/string of the original
+// is cloned per group with fresh ids, and each group gets its own
+// samples, approximating a large profile with a wide stack population.
+function scaleProfile(base, sampleCount) {
+  const p = {
+    sampleType: base.sampleType,
+    periodType: base.periodType,
+    period: base.period,
+    timeNanos: base.timeNanos,
+    durationNanos: base.durationNanos,
+    sample: [],
+    location: [],
+    function: [],
+    stringTable: base.stringTable.slice(),
+  };
+  const samplesPerGroup = base.sample.length;
+  const groups = Math.ceil(sampleCount / samplesPerGroup);
+  for (let g = 0; g < groups; g++) {
+    const functionIdBase = g * base.function.length;
+    const locationIdBase = g * base.location.length;
+    const stringBase = p.stringTable.length;
+    for (let i = 0; i < base.function.length; i++) {
+      const fn = base.function[i];
+      p.stringTable.push(`${base.stringTable[fn.name]}_${g}`);
+      p.function.push(
+        new perftools.profiles.Function({
+          id: functionIdBase + Number(fn.id),
+          name: stringBase + i,
+          systemName: stringBase + i,
+          filename: fn.filename,
+        })
+      );
+    }
+    for (const location of base.location) {
+      p.location.push(
+        new perftools.profiles.Location({
+          id: locationIdBase + Number(location.id),
+          line: location.line.map(
+            line =>
+              new perftools.profiles.Line({
+                functionId: functionIdBase + Number(line.functionId),
+                line: line.line,
+              })
+          ),
+        })
+      );
+    }
+    for (const sample of base.sample) {
+      p.sample.push(
+        new perftools.profiles.Sample({
+          locationId: sample.locationId.map(id => locationIdBase + Number(id)),
+          value: sample.value,
+          label: sample.label,
+        })
+      );
+    }
+  }
+  p.sample.length = Math.min(p.sample.length, sampleCount);
+  return p;
+}
+
+function measure(fn) {
+  const times = [];
+  for (let i = 0; i < ITERATIONS; i++) {
+    const start = process.hrtime.bigint();
+    fn();
+    times.push(Number(process.hrtime.bigint() - start) / 1e6);
+  }
+  times.sort((a, b) => a - b);
+  return {
+    minMillis: Number(times[0].toFixed(3)),
+    medianMillis: Number(times[Math.floor(times.length / 2)].toFixed(3)),
+    maxMillis: Number(times[times.length - 1].toFixed(3)),
+  };
+}
+
+function throughputMiBps(bytes, millis) {
+  return Number((bytes / (1024 * 1024) / (millis / 1000)).toFixed(1));
+}
+
+function main() {
+  const sampleCount = Number(process.argv[2] || DEFAULT_SAMPLE_COUNT);
+  const profile = scaleProfile(timeProfile, sampleCount);
+  const encoded = Buffer.from(
+    perftools.profiles.Profile.encode(profile).finish()
+  );
+
+  const generatedEncode = measure(() =>
+    perftools.profiles.Profile.encode(profile).finish()
+  );
+
+  // First encode pays full cost; subsequent encodes of an unchanged
+  // profile hit the incremental encoder's table caches.
+  const incrementalEncoder = new ProfileEncoder();
+  const incrementalFirst = measure(() => {
+    new ProfileEncoder().encode(profile);
+  });
+  incrementalEncoder.encode(profile);
+  const incrementalCached = measure(() => incrementalEncoder.encode(profile));
+
+  const gzipByLevel = {};
+  for (const level of GZIP_LEVELS) {
+    const timing = measure(() => zlib.gzipSync(encoded, {level}));
+    gzipByLevel[level] = Object.assign(
+      {throughputMiBps: throughputMiBps(encoded.length, timing.medianMillis)},
+      timing
+    );
+  }
+
+  // End-to-end cost of producing the profileBytes field for the JSON
+  // upload path: encode, gzip, base64.
+  const endToEnd = measure(() => {
+    zlib
+      .gzipSync(
+        Buffer.from(perftools.profiles.Profile.encode(profile).finish())
+      )
+      .toString('base64');
+  });
+
+  console.log(
+    JSON.stringify({
+      nodeVersion: process.version,
+      sampleCount: profile.sample.length,
+      encodedBytes: encoded.length,
+      iterations: ITERATIONS,
+      generatedEncode: Object.assign(
+        {
+          throughputMiBps: throughputMiBps(
+            encoded.length,
+            generatedEncode.medianMillis
+          ),
+        },
+        generatedEncode
+      ),
+      incrementalEncodeFirst: incrementalFirst,
+      incrementalEncodeCached: incrementalCached,
+      gzip: gzipByLevel,
+      endToEndProfileBytes: endToEnd,
+    })
+  );
+}
+
+main();
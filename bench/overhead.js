@@ -0,0 +1,198 @@
+// Copyright 2026 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures what the agent costs: the same busy workload as
+// system-test/busybench runs once without and once with the agent
+// (started with startLocal(), so no backend is needed), and the runs are
+// compared on CPU overhead, peak RSS and p99 event loop lag. Per-cycle
+// serialization timings come from the agent's own metrics. Output is one
+// JSON object; the process exits non-zero when a threshold is exceeded.
+//
+// Run after `npm run compile`:
+//
+//   node bench/overhead.js [durationSeconds] [arrMiB]
+//
+// Thresholds can be overridden with the OVERHEAD_BENCH_MAX_CPU_PERCENT,
+// OVERHEAD_BENCH_MAX_RSS_DELTA_MIB and OVERHEAD_BENCH_MAX_LAG_DELTA_MS
+// environment variables.
+
+'use strict';
+
+const {execFileSync} = require('child_process');
+const path = require('path');
+
+const DEFAULT_DURATION_SECONDS = 30;
+const DEFAULT_ARR_MIB = 64;
+
+function threshold(name, defaultValue) {
+  const value = Number(process.env[name]);
+  return isNaN(value) ? defaultValue : value;
+}
+
+// One measured run: the workload of system-test/busybench (a busy loop
+// over arrays re-filled with setTimeout) under event loop delay and RSS
+// monitoring, printing a JSON result on stdout when the duration elapses.
+function childMain(withAgent, durationSeconds, arrMiB) {
+  if (withAgent) {
+    const profiler = require(path.join(__dirname, '..', 'build', 'src'));
+    // projectId, zone and instance are all set, so the agent does not try
+    // to reach the metadata server when run off GCP.
+    profiler
+      .startLocal({
+        logLevel: 0,
+        projectId: 'overhead-bench',
+        zone: 'overhead-bench-zone',
+        instance: 'overhead-bench-instance',
+        serviceContext: {service: 'overhead-bench'},
+      })
+      .catch(err => {
+        console.error(`Could not start agent: ${err}`);
+        process.exit(1);
+      });
+  }
+
+  let histogram;
+  try {
+    // eslint-disable-next-line @typescript-eslint/no-var-requires
+    const {monitorEventLoopDelay} = require('perf_hooks');
+    histogram = monitorEventLoopDelay({resolution: 10});
+    histogram.enable();
+  } catch (err) {
+    histogram = undefined;
+  }
+
+  let maxRssBytes = 0;
+  const rssTimer = setInterval(() => {
+    maxRssBytes = Math.max(maxRssBytes, process.memoryUsage().rss);
+  }, 200);
+
+  const startTime = Date.now();
+  const testArr = [];
+  for (let i = 0; i < arrMiB; i++) {
+    // 8 bytes per number * 128 * 1024 = 1 MiB
+    testArr[i] = new Array(128 * 1024);
+  }
+
+  function busyLoop() {
+    for (let i = 0; i < testArr.length; i++) {
+      for (let j = 0; j < testArr[i].length; j++) {
+        testArr[i][j] = Math.sqrt(j * (testArr[i][j] || 1));
+      }
+    }
+    if (Date.now() - startTime < 1000 * durationSeconds) {
+      setTimeout(busyLoop, 5);
+    } else {
+      finish();
+    }
+  }
+
+  function finish() {
+    clearInterval(rssTimer);
+    const cpu = process.cpuUsage();
+    const result = {
+      cpuMicros: cpu.user + cpu.system,
+      maxRssBytes,
+      p99LagMillis: histogram ? histogram.percentile(99) / 1e6 : undefined,
+    };
+    if (withAgent) {
+      const profiler = require(path.join(__dirname, '..', 'build', 'src'));
+      result.metrics = profiler.getMetrics();
+    }
+    console.log(JSON.stringify(result));
+    process.exit(0);
+  }
+
+  busyLoop();
+}
+
+function run(withAgent, durationSeconds, arrMiB) {
+  const args = [
+    __filename,
+    '--child',
+    String(durationSeconds),
+    String(arrMiB),
+  ];
+  if (withAgent) {
+    args.push('--agent');
+  }
+  const out = execFileSync(process.execPath, args, {encoding: 'utf8'});
+  return JSON.parse(out.trim().split('\n').pop());
+}
+
+function main() {
+  if (process.argv[2] === '--child') {
+    childMain(
+      process.argv.includes('--agent'),
+      Number(process.argv[3]),
+      Number(process.argv[4])
+    );
+    return;
+  }
+
+  const durationSeconds = Number(process.argv[2] || DEFAULT_DURATION_SECONDS);
+  const arrMiB = Number(process.argv[3] || DEFAULT_ARR_MIB);
+  const thresholds = {
+    maxCpuOverheadPercent: threshold('OVERHEAD_BENCH_MAX_CPU_PERCENT', 10),
+    maxRssDeltaMiB: threshold('OVERHEAD_BENCH_MAX_RSS_DELTA_MIB', 150),
+    maxLagDeltaMillis: threshold('OVERHEAD_BENCH_MAX_LAG_DELTA_MS', 50),
+  };
+
+  const baseline = run(false, durationSeconds, arrMiB);
+  const withAgent = run(true, durationSeconds, arrMiB);
+
+  const cpuOverheadPercent =
+    (100 * (withAgent.cpuMicros - baseline.cpuMicros)) /
+    (durationSeconds * 1e6);
+  const rssDeltaMiB =
+    (withAgent.maxRssBytes - baseline.maxRssBytes) / (1024 * 1024);
+  const lagDeltaMillis =
+    withAgent.p99LagMillis !== undefined && baseline.p99LagMillis !== undefined
+      ? withAgent.p99LagMillis - baseline.p99LagMillis
+      : undefined;
+
+  const failures = [];
+  if (cpuOverheadPercent > thresholds.maxCpuOverheadPercent) {
+    failures.push('cpuOverheadPercent');
+  }
+  if (rssDeltaMiB > thresholds.maxRssDeltaMiB) {
+    failures.push('rssDeltaMiB');
+  }
+  if (
+    lagDeltaMillis !== undefined &&
+    lagDeltaMillis > thresholds.maxLagDeltaMillis
+  ) {
+    failures.push('lagDeltaMillis');
+  }
+
+  console.log(
+    JSON.stringify({
+      durationSeconds,
+      arrMiB,
+      baseline,
+      withAgent,
+      cpuOverheadPercent: Number(cpuOverheadPercent.toFixed(2)),
+      rssDeltaMiB: Number(rssDeltaMiB.toFixed(2)),
+      lagDeltaMillis:
+        lagDeltaMillis === undefined
+          ? undefined
+          : Number(lagDeltaMillis.toFixed(2)),
+      thresholds,
+      failures,
+      pass: failures.length === 0,
+    })
+  );
+  process.exit(failures.length === 0 ? 0 : 1);
+}
+
+main();
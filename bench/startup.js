@@ -0,0 +1,163 @@
+// Copyright 2026 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the agent's startup sequence end-to-end, phase by phase: the
+// cold require of the module, profiler creation (config initialization
+// including the GCLOUD_PROFILER_CONFIG file read, and the heap profiler
+// start), the source map scan, and the first wall and heap profile
+// collections. Each iteration runs in a fresh process so nothing is warm.
+// The metadata fetches are excluded by configuring projectId, zone and
+// instance, so the result is the startup cost the agent itself controls.
+//
+// Fast-start budget: the startup phases under the agent's control
+// (require + profiler creation + source map scan over an empty search
+// path) must stay under 100ms, since on the internal/preload auto-start
+// path this whole chain sits on the cold-start critical path of
+// serverless deployments. The process exits non-zero when the median
+// exceeds the budget, so a regression fails CI visibly. Output is one
+// JSON object with per-phase medians.
+//
+// Run after `npm run compile`:
+//
+//   node bench/startup.js
+//
+// The budget can be overridden with the STARTUP_BENCH_MAX_STARTUP_MS
+// environment variable.
+
+'use strict';
+
+const {execFileSync} = require('child_process');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+
+const ITERATIONS = 5;
+const DEFAULT_MAX_STARTUP_MS = 100;
+
+function nowMillis() {
+  return Number(process.hrtime.bigint()) / 1e6;
+}
+
+// One measured startup in a fresh process; prints per-phase timings as
+// JSON on stdout.
+async function childMain(searchPath) {
+  const phases = {};
+
+  let start = nowMillis();
+  const profiler = require(path.join(__dirname, '..', 'build', 'src'));
+  phases.requireMillis = nowMillis() - start;
+
+  // projectId, zone and instance are all set, so initConfigMetadata makes
+  // no network requests; what remains is the config file read and parse,
+  // local config merging and the heap profiler start.
+  start = nowMillis();
+  const agent = await profiler.createProfiler({
+    projectId: 'startup-bench',
+    zone: 'startup-bench-zone',
+    instance: 'startup-bench-instance',
+    serviceContext: {service: 'startup-bench'},
+    disableSourceMaps: true,
+    logLevel: 0,
+  });
+  phases.createProfilerMillis = nowMillis() - start;
+
+  // The source map scan runs on profiler.start(); measured here directly
+  // so starting the poll loop (which needs a backend) is not required.
+  start = nowMillis();
+  const {SourceMapper} = require('pprof');
+  await SourceMapper.create([searchPath]);
+  phases.sourceMapperMillis = nowMillis() - start;
+
+  // Includes the 100ms profiling window itself plus serialization.
+  start = nowMillis();
+  await agent.profile({
+    name: 'startup-bench-wall',
+    profileType: 'WALL',
+    duration: '100ms',
+  });
+  phases.firstWallProfileMillis = nowMillis() - start;
+
+  start = nowMillis();
+  await agent.profile({name: 'startup-bench-heap', profileType: 'HEAP'});
+  phases.firstHeapProfileMillis = nowMillis() - start;
+
+  phases.startupMillis =
+    phases.requireMillis +
+    phases.createProfilerMillis +
+    phases.sourceMapperMillis;
+  agent.stop();
+  console.log(JSON.stringify(phases));
+  process.exit(0);
+}
+
+function median(values) {
+  const sorted = values.slice().sort((a, b) => a - b);
+  return sorted[Math.floor(sorted.length / 2)];
+}
+
+function main() {
+  const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'startup-bench-'));
+  // An on-disk config file puts the GCLOUD_PROFILER_CONFIG read and parse
+  // on the measured path, as deployments using it would see.
+  const configFile = path.join(dir, 'config.json');
+  fs.writeFileSync(
+    configFile,
+    JSON.stringify({serviceContext: {service: 'startup-bench'}})
+  );
+  const searchPath = path.join(dir, 'empty');
+  fs.mkdirSync(searchPath);
+
+  const runs = [];
+  for (let i = 0; i < ITERATIONS; i++) {
+    const out = execFileSync(
+      process.execPath,
+      [__filename, '--child', searchPath],
+      {
+        encoding: 'utf8',
+        env: Object.assign({}, process.env, {
+          GCLOUD_PROFILER_CONFIG: configFile,
+        }),
+      }
+    );
+    runs.push(JSON.parse(out.trim().split('\n').pop()));
+  }
+
+  const result = {node: process.version, iterations: ITERATIONS};
+  for (const phase of Object.keys(runs[0])) {
+    result[phase] = Number(median(runs.map(r => r[phase])).toFixed(3));
+  }
+
+  const maxStartupMillis = Number(
+    process.env.STARTUP_BENCH_MAX_STARTUP_MS || DEFAULT_MAX_STARTUP_MS
+  );
+  result.maxStartupMillis = maxStartupMillis;
+  result.withinBudget = result.startupMillis <= maxStartupMillis;
+  console.log(JSON.stringify(result, null, 2));
+  if (!result.withinBudget) {
+    console.error(
+      `Startup took ${result.startupMillis}ms, over the ` +
+        `${maxStartupMillis}ms budget.`
+    );
+    process.exit(1);
+  }
+}
+
+if (process.argv[2] === '--child') {
+  childMain(process.argv[3]).catch(err => {
+    console.error(`Startup benchmark failed: ${err}`);
+    process.exit(1);
+  });
+} else {
+  main();
+}
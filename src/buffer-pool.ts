@@ -0,0 +1,129 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as zlib from 'zlib';
+
+// A pooled buffer more than this many times larger than recent use is
+// considered oversized.
+const OVERSIZE_FACTOR = 4;
+
+// Number of consecutive oversized releases before the pool shrinks its
+// buffer back down.
+const OVERSIZE_TOLERANCE = 10;
+
+function nextPowerOfTwo(n: number): number {
+  let size = 1024;
+  while (size < n) {
+    size *= 2;
+  }
+  return size;
+}
+
+/**
+ * Pool holding one reusable output buffer, sized to the high-water mark of
+ * recent profiles. Serialization runs once a minute per profile type and
+ * profile sizes are stable in steady state, so a single pooled buffer
+ * turns the per-cycle output allocation into a no-op. If use shrinks for a
+ * sustained period the buffer is reallocated smaller, so a one-off large
+ * profile does not pin memory forever.
+ *
+ * Public for testing.
+ */
+export class BufferPool {
+  private buffer: Buffer | undefined;
+  private oversizedReleases = 0;
+
+  constructor(readonly initialSize = 256 * 1024) {}
+
+  /**
+   * Checks a buffer with capacity of at least sizeHint bytes out of the
+   * pool. The buffer's contents are uninitialized.
+   */
+  acquire(sizeHint: number): Buffer {
+    const size = Math.max(sizeHint, this.initialSize);
+    let buf = this.buffer;
+    this.buffer = undefined;
+    if (!buf || buf.length < size) {
+      buf = Buffer.allocUnsafe(nextPowerOfTwo(size));
+    }
+    return buf;
+  }
+
+  /**
+   * Returns a buffer of which usedBytes were used to the pool. Shrinks the
+   * pooled buffer after OVERSIZE_TOLERANCE consecutive releases which used
+   * less than 1/OVERSIZE_FACTOR of its capacity.
+   */
+  release(buf: Buffer, usedBytes: number): void {
+    if (usedBytes * OVERSIZE_FACTOR < buf.length) {
+      this.oversizedReleases++;
+      if (this.oversizedReleases >= OVERSIZE_TOLERANCE) {
+        this.oversizedReleases = 0;
+        this.buffer = Buffer.allocUnsafe(
+          nextPowerOfTwo(Math.max(usedBytes, this.initialSize))
+        );
+        return;
+      }
+    } else {
+      this.oversizedReleases = 0;
+    }
+    if (!this.buffer || buf.length > this.buffer.length) {
+      this.buffer = buf;
+    }
+  }
+}
+
+/**
+ * Compresses input, assembling the compressed stream into a buffer checked
+ * out of pool, and returns it base64-encoded. In steady state the pooled
+ * buffer is reused across cycles, so compression output does not allocate;
+ * the base64 string is the only remaining per-cycle allocation.
+ *
+ * Compresses with default-level gzip unless a different compression
+ * transform is supplied.
+ */
+export function gzipToBase64(
+  input: Uint8Array,
+  pool: BufferPool,
+  stream?: NodeJS.ReadWriteStream
+): Promise<string> {
+  return new Promise<string>((resolve, reject) => {
+    const gzipStream = stream || zlib.createGzip();
+    // Compressed profiles are smaller than their input; the pool rounds
+    // the hint up and grows on demand if the estimate is short.
+    let out = pool.acquire(Math.ceil(input.length / 2));
+    let used = 0;
+    gzipStream.on('data', (chunk: Buffer) => {
+      if (used + chunk.length > out.length) {
+        const grown = pool.acquire(
+          nextPowerOfTwo(used + chunk.length)
+        );
+        out.copy(grown, 0, 0, used);
+        out = grown;
+      }
+      chunk.copy(out, used);
+      used += chunk.length;
+    });
+    gzipStream.on('error', (err: Error) => {
+      pool.release(out, used);
+      reject(err);
+    });
+    gzipStream.on('end', () => {
+      const base64 = out.toString('base64', 0, used);
+      pool.release(out, used);
+      resolve(base64);
+    });
+    gzipStream.end(input);
+  });
+}
@@ -0,0 +1,185 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as cluster from 'cluster';
+import {heap as heapProfiler, time as timeProfiler} from 'pprof';
+
+import {createCompressor} from './compression';
+import {LocalConfig, ProfilerConfig} from './config';
+import {createLogger} from './logger';
+import {RequestProfile} from './profiler';
+
+import parseDuration from 'parse-duration';
+
+// IPC message types exchanged between the coordinator and workers;
+// namespaced so they cannot collide with application messages.
+export const MESSAGE_TYPE_COLLECT = 'cloud-profiler:collect';
+export const MESSAGE_TYPE_PROFILE = 'cloud-profiler:profile';
+
+// Extra time, beyond the profile duration, the coordinator waits for a
+// worker's reply before giving up on the collection.
+const COLLECT_GRACE_MILLIS = 10 * 1000;
+
+interface CollectMessage {
+  type: typeof MESSAGE_TYPE_COLLECT;
+  id: number;
+  profileType: string;
+  durationMillis?: number;
+  intervalMicros: number;
+}
+
+interface ProfileMessage {
+  type: typeof MESSAGE_TYPE_PROFILE;
+  id: number;
+  // Serialized, compressed profile, base64-encoded for the IPC channel.
+  profileBytes?: string;
+  error?: string;
+}
+
+/**
+ * Returns a collection delegate for a Profiler running in the cluster
+ * primary: each collection request from the profiler server is forwarded
+ * over the cluster IPC channel to one of the connected workers, chosen
+ * round-robin so the sampling cost rotates across them, and the worker's
+ * serialized profile is attached to prof for upload. With this, one
+ * process owns the long-poll, the metadata fetches and the uploads; the
+ * workers only pay for collection when asked.
+ */
+export function clusterCollectDelegate(
+  config: ProfilerConfig
+): (prof: RequestProfile) => Promise<RequestProfile> {
+  let nextWorkerIndex = 0;
+  let nextRequestId = 0;
+  return (prof: RequestProfile) =>
+    new Promise<RequestProfile>((resolve, reject) => {
+      const workers = Object.keys(cluster.workers || {})
+        .map(id => cluster.workers![id])
+        .filter(worker => worker !== undefined && worker.isConnected());
+      if (workers.length === 0) {
+        reject(new Error('No connected cluster workers to profile.'));
+        return;
+      }
+      const worker = workers[nextWorkerIndex++ % workers.length]!;
+      const id = nextRequestId++;
+      const durationMillis = prof.duration
+        ? parseDuration(prof.duration) || undefined
+        : undefined;
+
+      const cleanup = () => {
+        clearTimeout(timeout);
+        worker.removeListener('message', onMessage);
+      };
+      const timeout = setTimeout(() => {
+        cleanup();
+        reject(
+          new Error(
+            `Worker ${worker.id} did not return a ${prof.profileType}` +
+              ' profile in time.'
+          )
+        );
+      }, (durationMillis || 0) + COLLECT_GRACE_MILLIS);
+      timeout.unref();
+
+      // eslint-disable-next-line @typescript-eslint/no-explicit-any
+      const onMessage = (message: any) => {
+        if (
+          !message ||
+          message.type !== MESSAGE_TYPE_PROFILE ||
+          message.id !== id
+        ) {
+          return;
+        }
+        cleanup();
+        const reply = message as ProfileMessage;
+        if (reply.error || !reply.profileBytes) {
+          reject(
+            new Error(
+              `Worker ${worker.id} could not collect profile: ${reply.error}`
+            )
+          );
+          return;
+        }
+        if (config.binaryUpload) {
+          prof.rawProfileBytes = Buffer.from(reply.profileBytes, 'base64');
+        } else {
+          prof.profileBytes = reply.profileBytes;
+        }
+        resolve(prof);
+      };
+      worker.on('message', onMessage);
+
+      const request: CollectMessage = {
+        type: MESSAGE_TYPE_COLLECT,
+        id,
+        profileType: prof.profileType,
+        durationMillis,
+        intervalMicros: config.timeIntervalMicros,
+      };
+      worker.send(request);
+    });
+}
+
+/**
+ * Runs the worker side of coordinator mode: no long-poll, no metadata
+ * fetches and no source map scan — just the heap sampler (when enabled)
+ * and an IPC listener which collects and serializes a profile when the
+ * coordinator asks. Profiles collected here are not source-mapped; the
+ * coordinator receives them already materialized.
+ */
+export function startClusterWorker(config: LocalConfig): void {
+  const logger = createLogger(config.logLevel, config.asyncLogging);
+  // Workers compress with the same codec the coordinator would, so the
+  // bytes they hand back can be uploaded as-is.
+  const compressor = createCompressor(
+    config.compressionCodec,
+    config.compressionLevel
+  );
+  if (!config.disableHeap) {
+    heapProfiler.start(config.heapIntervalBytes, config.heapMaxStackDepth);
+  }
+  // eslint-disable-next-line @typescript-eslint/no-explicit-any
+  process.on('message', async (message: any) => {
+    if (!message || message.type !== MESSAGE_TYPE_COLLECT) {
+      return;
+    }
+    const request = message as CollectMessage;
+    const reply: ProfileMessage = {type: MESSAGE_TYPE_PROFILE, id: request.id};
+    try {
+      let p;
+      if (request.profileType === 'WALL') {
+        p = await timeProfiler.profile({
+          durationMillis: request.durationMillis!,
+          intervalMicros: request.intervalMicros,
+        });
+      } else if (request.profileType === 'HEAP') {
+        p = heapProfiler.profile(config.ignoreHeapSamplesPath);
+      } else {
+        throw new Error(`Unexpected profile type ${request.profileType}.`);
+      }
+      // eslint-disable-next-line @typescript-eslint/no-var-requires
+      const {perftools} = require('../protos/profile');
+      const buffer = Buffer.from(perftools.profiles.Profile.encode(p).finish());
+      reply.profileBytes = (await compressor.compress(buffer)).toString(
+        'base64'
+      );
+    } catch (err) {
+      logger.debug(`Failed to collect profile for coordinator: ${err}`);
+      reply.error = String(err);
+    }
+    if (process.send) {
+      process.send(reply);
+    }
+  });
+  logger.debug('Cluster worker ready to collect profiles for coordinator.');
+}
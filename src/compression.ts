@@ -0,0 +1,140 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import {Transform} from 'stream';
+import {promisify} from 'util';
+import * as zlib from 'zlib';
+
+/** Codecs the agent can compress profile payloads with. */
+export type CompressionCodec = 'gzip' | 'brotli' | 'zstd';
+
+/**
+ * One configured compression codec, usable from each of the agent's encode
+ * paths: promise-based for the main thread, synchronous for the encode
+ * worker, and as a transform stream for the streaming and pooled-buffer
+ * paths.
+ */
+export interface Compressor {
+  // The codec actually in use. Differs from the requested codec when that
+  // codec is not provided by the running Node version, in which case gzip
+  // is used.
+  readonly codec: CompressionCodec;
+  compress(input: Uint8Array): Promise<Buffer>;
+  compressSync(input: Uint8Array): Buffer;
+  createStream(): Transform;
+}
+
+/** @return true iff the running Node version can compress with codec. */
+export function codecAvailable(codec: CompressionCodec): boolean {
+  switch (codec) {
+    case 'brotli':
+      // Node 10.16 and later.
+      return typeof zlib.brotliCompress === 'function';
+    case 'zstd':
+      // Provided by zlib in recent Node versions only.
+      // eslint-disable-next-line @typescript-eslint/no-explicit-any
+      return typeof (zlib as any).zstdCompress === 'function';
+    default:
+      return true;
+  }
+}
+
+/**
+ * @return the file extension conventionally used for pprof profiles
+ * compressed with codec, after the same availability fallback
+ * createCompressor applies.
+ */
+export function codecFileExtension(codec?: CompressionCodec): string {
+  if (codec === undefined || !codecAvailable(codec)) {
+    codec = 'gzip';
+  }
+  switch (codec) {
+    case 'brotli':
+      return 'pb.br';
+    case 'zstd':
+      return 'pb.zst';
+    default:
+      return 'pb.gz';
+  }
+}
+
+// promisify cannot see through the zlib overloads which take options, so
+// the promisified functions are given their two-argument signatures here.
+const gzipAsync = promisify(zlib.gzip) as (
+  input: Uint8Array,
+  options: zlib.ZlibOptions
+) => Promise<Buffer>;
+
+/**
+ * Builds a Compressor for the requested codec and level. When the codec is
+ * not available in the running Node version the returned compressor uses
+ * gzip instead; callers can compare its codec field against the request to
+ * log the substitution. An undefined level means the codec's default.
+ */
+export function createCompressor(
+  codec: CompressionCodec = 'gzip',
+  level?: number
+): Compressor {
+  if (!codecAvailable(codec)) {
+    codec = 'gzip';
+  }
+  switch (codec) {
+    case 'brotli': {
+      const options: zlib.BrotliOptions =
+        level === undefined
+          ? {}
+          : {params: {[zlib.constants.BROTLI_PARAM_QUALITY]: level}};
+      const brotliAsync = promisify(zlib.brotliCompress) as (
+        input: Uint8Array,
+        options: zlib.BrotliOptions
+      ) => Promise<Buffer>;
+      return {
+        codec,
+        compress: input => brotliAsync(input, options),
+        compressSync: input => zlib.brotliCompressSync(input, options),
+        createStream: () => zlib.createBrotliCompress(options),
+      };
+    }
+    case 'zstd': {
+      // The zstd bindings are too new for the typings this package
+      // compiles against.
+      // eslint-disable-next-line @typescript-eslint/no-explicit-any
+      const z = zlib as any;
+      const options =
+        level === undefined
+          ? {}
+          : {params: {[z.constants.ZSTD_c_compressionLevel]: level}};
+      const zstdAsync = promisify(z.zstdCompress) as (
+        input: Uint8Array,
+        // eslint-disable-next-line @typescript-eslint/no-explicit-any
+        options: any
+      ) => Promise<Buffer>;
+      return {
+        codec,
+        compress: input => zstdAsync(input, options),
+        compressSync: input => z.zstdCompressSync(input, options),
+        createStream: () => z.createZstdCompress(options),
+      };
+    }
+    default: {
+      const options: zlib.ZlibOptions = level === undefined ? {} : {level};
+      return {
+        codec: 'gzip',
+        compress: input => gzipAsync(input, options),
+        compressSync: input => zlib.gzipSync(input, options),
+        createStream: () => zlib.createGzip(options),
+      };
+    }
+  }
+}
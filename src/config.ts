@@ -15,6 +15,8 @@
 import {GoogleAuthOptions} from '@google-cloud/common';
 import parseDuration from 'parse-duration';
 
+import type {Metrics} from './metrics';
+
 // Configuration for Profiler.
 export interface Config extends GoogleAuthOptions {
   /**
@@ -23,6 +25,16 @@ export interface Config extends GoogleAuthOptions {
    */
   apiEndpoint?: string;
 
+  /**
+   * Prioritized list of API endpoints. The first healthy endpoint is
+   * used; when a request to it fails, the next one is tried and the
+   * failing endpoint is placed in a cool-down which grows with
+   * consecutive failures, so a regional incident on the primary endpoint
+   * degrades to the fallback instead of leaving the agent in backoff.
+   * Defaults to just apiEndpoint.
+   */
+  apiEndpoints?: string[];
+
   // Cloud Console projectId to associate profiles with instead of one read
   // from VM metadata server.
   projectId?: string;
@@ -31,6 +43,15 @@ export interface Config extends GoogleAuthOptions {
   // Log statements are printed to the console.
   logLevel?: number;
 
+  // When true, the agent's log lines are buffered in memory and flushed
+  // to stderr asynchronously in batches, as structured JSON lines, so
+  // enabling debug logging cannot block the event loop when the log
+  // pipeline backpressures. Lines arriving while the buffer is full are
+  // dropped and the drop count reported with the next batch. When false,
+  // log lines are written synchronously through the console, the previous
+  // behavior.
+  asyncLogging?: boolean;
+
   // Specifies the service with which profiles from this application will be
   // associated.
   serviceContext?: {
@@ -68,12 +89,30 @@ export interface Config extends GoogleAuthOptions {
   // Decreasing time between samples may increase overhead of profiling.
   timeIntervalMicros?: number;
 
+  // CPU overhead budget for time profiling, as a percentage of the
+  // profiled window. When set, the agent measures its own profiling cost
+  // (sample counts and serialization time) each cycle and adjusts the
+  // sampling interval around timeIntervalMicros to stay under this budget,
+  // tightening the interval when headroom exists and backing off under
+  // load. When unset, timeIntervalMicros is used as-is.
+  maxOverheadPercent?: number;
+
   // Average bytes between samples collected by heap profiler.
   // Increasing the bytes between samples will reduce quality of profiles by
   // reducing number of samples.
   // Decreasing bytes between samples may increase overhead of profiling.
   heapIntervalBytes?: number;
 
+  // Desired number of samples per heap profile. When set, the agent
+  // compares the sample count of each collected heap profile against this
+  // target and restarts the heap sampler with an adjusted interval between
+  // collection cycles, so the sampling cost tracks the observed allocation
+  // rate rather than a fixed heapIntervalBytes. Adjustments are damped and
+  // bounded to within 16x of heapIntervalBytes in either direction. Note
+  // that restarting the sampler discards samples accumulated so far, so
+  // the profile following an adjustment reflects a shorter window.
+  heapTargetSampleCount?: number;
+
   // Maximum depth of stacks recorded for heap samples. Decreasing stack depth
   // will make it more likely that stack traces are truncated. Increasing
   // stack depth may increase overhead of profiling.
@@ -85,6 +124,21 @@ export interface Config extends GoogleAuthOptions {
   // the profiler.
   ignoreHeapSamplesPath?: string;
 
+  // Like ignoreHeapSamplesPath, but accepts several substrings, useful
+  // for excluding multiple infrastructure libraries at once. The patterns
+  // are compiled into a single multi-pattern matcher which runs once per
+  // string table entry of the collected profile, so filtering cost does
+  // not grow with the number of patterns or the sample count. Applied in
+  // addition to ignoreHeapSamplesPath.
+  ignoreHeapSamplesPaths?: string[];
+
+  // Upload latency, in milliseconds, above which a second upload attempt
+  // is raced against the next healthy endpoint from apiEndpoints, taking
+  // whichever succeeds first. Hedging bounds upload tail latency when an
+  // endpoint is degraded but not down. Only effective when apiEndpoints
+  // lists more than one endpoint; unset by default (no hedging).
+  hedgeUploadLatencyMillis?: number;
+
   // On each consecutive error in profile creation, the backoff envelope will
   // increase by this factor. The backoff will be a random value selected
   // from a uniform distribution between 0 and the backoff envelope.
@@ -102,6 +156,83 @@ export interface Config extends GoogleAuthOptions {
   // again.
   backoffCapMillis?: number;
 
+  // When true, collected profiles are uploaded as a binary-encoded Profile
+  // message with profile bytes sent raw, instead of base64-encoded inside a
+  // JSON request body. This avoids the ~33% base64 payload inflation and
+  // the extra in-memory string copy of each profile.
+  binaryUpload?: boolean;
+
+  // Codec used to compress profile payloads. Defaults to gzip, which the
+  // profiler API accepts; brotli and zstd trade compatibility for speed or
+  // ratio and are chiefly useful with local output modes, or against a
+  // server known to accept them. zstd at low compressionLevel settings
+  // compresses profiles several times faster than default-level gzip at a
+  // comparable ratio. brotli requires Node 10.16 or later and zstd a Node
+  // version whose zlib provides it; when the requested codec is not
+  // available, gzip is used and a warning logged.
+  compressionCodec?: 'gzip' | 'brotli' | 'zstd';
+
+  // Compression level passed to the codec (gzip: 0-9, brotli quality:
+  // 0-11, zstd: 1-22). Lower levels cost less CPU per profile at a
+  // somewhat larger payload. When unset, the codec's default is used.
+  compressionLevel?: number;
+
+  // When true, requests to the profiler API are made over a persistent
+  // keep-alive connection, so consecutive polls and uploads reuse one
+  // connection instead of paying a TCP and TLS handshake each cycle. When
+  // false, every request opens a fresh connection.
+  keepAlive?: boolean;
+
+  // Maximum number of profile uploads which can be in flight at once. When
+  // greater than 1, the next poll to the profiler server is issued
+  // concurrently with the upload of the profile just collected. Setting
+  // this to 1 restores fully serial behavior, where the next poll waits for
+  // the previous upload to complete.
+  maxPendingUploads?: number;
+
+  // When true, the profiler is constructed and started with the locally
+  // known configuration, and projectId, zone and instance are filled in
+  // from the metadata service in the background; the first poll to the
+  // profiler server waits for them. This takes the metadata fetches off
+  // the startup critical path, which matters for short-lived and
+  // serverless deployments where they can add seconds before start()
+  // resolves. When the metadata cannot be resolved and no projectId is
+  // configured, profiling stops with an error log instead of start()
+  // rejecting.
+  deferMetadata?: boolean;
+
+  // When true, event loop delay and event loop utilization are sampled
+  // during each time profiling window and their aggregates (median and
+  // maximum lag in milliseconds, and the fraction of the window the event
+  // loop was active) are attached to the uploaded profile as labels, so
+  // saturation context travels with the profile instead of requiring a
+  // separate metrics system. Measurement uses perf_hooks and costs one
+  // delay histogram per window; metrics whose perf_hooks API the running
+  // Node version lacks are omitted.
+  collectEventLoopStats?: boolean;
+
+  // Event loop lag threshold, in milliseconds, above which profile
+  // collection is deferred to the next cycle. Lag is measured with the
+  // perf_hooks event loop delay histogram over the window since the last
+  // collection; deferring under saturation keeps the agent from adding
+  // profiling and serialization cost during a traffic spike. When unset,
+  // profiles are always collected. Has no effect on Node versions without
+  // perf_hooks.monitorEventLoopDelay.
+  maxEventLoopLagMillis?: number;
+
+  // Number of profiles kept in memory for retry when an upload fails with a
+  // retriable error (a network error or 5xx response). Queued profiles are
+  // re-uploaded in a batch once an upload succeeds again, or after a
+  // backoff. The oldest profile is dropped (or spilled to
+  // uploadRetryQueueDir) when the queue is full. Set to 0 to drop failed
+  // uploads immediately, the previous behavior.
+  uploadRetryQueueSize?: number;
+
+  // Directory used to spill already-compressed profiles evicted from the
+  // in-memory retry queue. Spilled profiles are re-uploaded after the
+  // in-memory queue drains. Unset by default; evicted profiles are dropped.
+  uploadRetryQueueDir?: string;
+
   // Server-specified backoffs will be capped at serverBackoffCapMillis.
   // The backoff is capped here because setTimeout (which is used to control
   // when next profile is collected) will run immediately if the backoff is
@@ -122,6 +253,22 @@ export interface Config extends GoogleAuthOptions {
   // For testing with startLocal() only.
   localTimeDurationMillis?: number;
 
+  // Directory into which startLocal() records the profiles it collects,
+  // each as one compressed pprof file, turning the local mode into a
+  // flight recorder: collection runs continuously on the
+  // localProfilingPeriodMillis cadence and the directory always holds a
+  // rolling window of the most recent profiles, ready to be pulled off
+  // disk during an incident in environments with no route to the profiler
+  // API. Serialization reuses the regular encode paths (including the
+  // encode worker), so always-on recording adds only the collection cost.
+  // Unset by default; startLocal() discards collected profiles.
+  flightRecorderPath?: string;
+
+  // Total size budget, in bytes, for the flight recorder directory. The
+  // oldest recorded profiles are deleted once the budget is exceeded.
+  // Defaults to 64 MiB.
+  flightRecorderMaxBytes?: number;
+
   // List of directories recursively searched for *.js.map files. Defaults to
   // process.cwd().
   //
@@ -142,31 +289,114 @@ export interface Config extends GoogleAuthOptions {
   // All locations in profiles will reference locations in the running
   // JavaScript.
   disableSourceMaps?: boolean;
+
+  // Path of a file used to persist the source map index between process
+  // starts. When set, the index built by scanning sourceMapSearchPath is
+  // written to this path, and a later start loads it with one sequential
+  // read instead of a full directory walk. Entries are validated against
+  // the mtime and size of the indexed files, so a stale index is discarded
+  // and the scan re-run. Unset by default; no index is persisted.
+  sourceMapCachePath?: string;
+
+  // Rough cap, in bytes, on the memory held by parsed source maps. When
+  // the maps found under sourceMapSearchPath exceed the cap, the least
+  // recently used parsed maps are spilled to a per-process temporary
+  // directory and re-parsed the next time a profile references their
+  // file. Useful for bundled services whose parsed mappings would
+  // otherwise keep hundreds of megabytes resident, where the previous
+  // options were disableSourceMaps or an OOM kill. Unset by default; all
+  // parsed maps are kept in memory.
+  sourceMapCacheMaxBytes?: number;
+
+  // When true, the search for source maps happens in the background and
+  // profiling begins immediately, rather than waiting for the recursive
+  // scan of sourceMapSearchPath to complete. Profiles collected before
+  // indexing completes will reference locations in the running JavaScript.
+  // Useful when the search path holds many files and scanning it delays the
+  // first profile and competes with application warmup.
+  deferSourceMaps?: boolean;
+
+  // When true, profiles will be serialized and compressed on the main
+  // thread instead of being handed off to a worker thread. By default
+  // serialization is done off the main thread so it does not block the
+  // event loop of the profiled application.
+  disableEncodeWorker?: boolean;
+
+  // When true, main-thread serialization is done in small batches fed
+  // into a streaming gzip, yielding to the event loop between batches, so
+  // the end-of-window serialization cost is spread over many short turns
+  // instead of landing as a single burst when the profile duration
+  // elapses. Only relevant together with disableEncodeWorker (or where
+  // worker threads are unavailable): on the worker path serialization is
+  // already off the main thread.
+  streamingEncode?: boolean;
+
+  // When true and the process is part of a Node cluster, only the
+  // primary talks to the profiler server: it owns the long-poll, the
+  // metadata fetches and uploads, and forwards each collection request
+  // over the cluster IPC channel to one of the connected workers, chosen
+  // round-robin. Workers pay only for collection, so per-pod agent
+  // overhead (hanging connections, metadata fetches, source map indexes)
+  // is paid once instead of per worker. start() must be called in the
+  // primary and in every worker with this option set. Profiles collected
+  // in workers are not source-mapped.
+  clusterProfiling?: boolean;
+
+  // Called with a snapshot of the agent's self-telemetry (see
+  // Profiler.getMetrics()) after each profiling cycle, so agent overhead
+  // can be wired into external monitoring. Exceptions thrown by the
+  // callback are logged and otherwise ignored.
+  metricsCallback?: (metrics: Metrics) => void;
 }
 
 // Interface for config after local initialization.
 export interface LocalConfig extends GoogleAuthOptions {
   apiEndpoint: string;
+  apiEndpoints?: string[];
+  hedgeUploadLatencyMillis?: number;
   projectId?: string;
   logLevel: number;
+  asyncLogging?: boolean;
   serviceContext: {service: string; version?: string};
   instance?: string;
   zone?: string;
   disableTime: boolean;
   disableHeap: boolean;
+  deferMetadata?: boolean;
   timeIntervalMicros: number;
+  maxOverheadPercent?: number;
   heapIntervalBytes: number;
+  heapTargetSampleCount?: number;
   heapMaxStackDepth: number;
   ignoreHeapSamplesPath: string;
+  ignoreHeapSamplesPaths?: string[];
   initialBackoffMillis: number;
   backoffCapMillis: number;
   backoffMultiplier: number;
+  binaryUpload: boolean;
+  compressionCodec?: 'gzip' | 'brotli' | 'zstd';
+  compressionLevel?: number;
+  keepAlive: boolean;
+  collectEventLoopStats?: boolean;
+  maxEventLoopLagMillis?: number;
+  maxPendingUploads: number;
+  uploadRetryQueueSize: number;
+  uploadRetryQueueDir?: string;
   serverBackoffCapMillis: number;
   localProfilingPeriodMillis: number;
   localLogPeriodMillis: number;
   localTimeDurationMillis: number;
+  flightRecorderPath?: string;
+  flightRecorderMaxBytes?: number;
   sourceMapSearchPath: string[];
   disableSourceMaps: boolean;
+  deferSourceMaps: boolean;
+  sourceMapCachePath?: string;
+  sourceMapCacheMaxBytes?: number;
+  disableEncodeWorker: boolean;
+  streamingEncode: boolean;
+  clusterProfiling?: boolean;
+  metricsCallback?: (metrics: Metrics) => void;
 }
 
 // Interface for an initialized profiler config.
@@ -187,6 +417,10 @@ export const defaultConfig = {
   initialBackoffMillis: 60 * 1000, // 1 minute
   backoffCapMillis: parseDuration('1h'),
   backoffMultiplier: 1.3,
+  binaryUpload: false,
+  keepAlive: true,
+  maxPendingUploads: 2,
+  uploadRetryQueueSize: 5,
   apiEndpoint: 'cloudprofiler.googleapis.com',
 
   // This is the largest duration for setTimeout which does not cause it to
@@ -199,4 +433,7 @@ export const defaultConfig = {
   localTimeDurationMillis: 1000,
   sourceMapSearchPath: [process.cwd()],
   disableSourceMaps: false,
+  deferSourceMaps: false,
+  disableEncodeWorker: false,
+  streamingEncode: false,
 };
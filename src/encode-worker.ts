@@ -0,0 +1,76 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Entry point for the encode worker started by EncoderPool. Receives a
+// profile, serializes and compresses it off the main thread, and transfers
+// the compressed bytes back as an ArrayBuffer.
+
+import {parentPort, workerData} from 'worker_threads';
+
+import {perftools} from '../protos/profile';
+import {createCompressor} from './compression';
+import {ProfileEncoder} from './profile-encoder';
+
+interface EncodeRequest {
+  id: number;
+  profile: perftools.profiles.IProfile;
+
+  // When set, an incremental encoder is kept per cacheKey for the life of
+  // the worker, so table entries unchanged since the previous profile with
+  // the same key are not re-encoded.
+  cacheKey?: string;
+}
+
+// Incremental encoders by cacheKey. The worker outlives individual encodes,
+// so consecutive profiles of one type reuse their interned table bytes.
+const encoders: Map<string, ProfileEncoder> = new Map();
+
+// Codec and level come from the pool via workerData; the pool passes a
+// codec it has already verified is available.
+const compressor = createCompressor(
+  workerData && workerData.codec,
+  workerData && workerData.level
+);
+
+function encodeProfile(message: EncodeRequest): Uint8Array {
+  if (message.cacheKey === undefined) {
+    return perftools.profiles.Profile.encode(message.profile).finish();
+  }
+  let encoder = encoders.get(message.cacheKey);
+  if (!encoder) {
+    encoder = new ProfileEncoder();
+    encoders.set(message.cacheKey, encoder);
+  }
+  return encoder.encode(message.profile);
+}
+
+if (parentPort) {
+  const port = parentPort;
+  port.on('message', (message: EncodeRequest) => {
+    try {
+      const buffer = encodeProfile(message);
+      const gzBuf = compressor.compressSync(buffer);
+
+      // Copy into a dedicated ArrayBuffer so it can be transferred without
+      // detaching zlib's internal pool.
+      const bytes = gzBuf.buffer.slice(
+        gzBuf.byteOffset,
+        gzBuf.byteOffset + gzBuf.byteLength
+      );
+      port.postMessage({id: message.id, bytes}, [bytes]);
+    } catch (err) {
+      port.postMessage({id: message.id, error: String(err)});
+    }
+  });
+}
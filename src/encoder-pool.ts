@@ -0,0 +1,137 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import {Worker} from 'worker_threads';
+
+import type {perftools} from '../protos/profile';
+import type {CompressionCodec} from './compression';
+
+interface PendingEncode {
+  resolve: (bytes: Buffer) => void;
+  reject: (err: Error) => void;
+}
+
+interface EncodeResponse {
+  id: number;
+  bytes?: ArrayBuffer;
+  error?: string;
+}
+
+/**
+ * Pool which offloads profile serialization and compression to a
+ * worker thread, so the event loop of the profiled application never sees
+ * the serialization cost. The worker is started lazily on the first encode
+ * and unref'd while idle so it does not keep the process alive.
+ *
+ * Profile collection happens at most once per minute per profile type, so a
+ * single worker is sufficient; jobs are multiplexed over it by id.
+ *
+ * Public for testing.
+ */
+export class EncoderPool {
+  private worker: Worker | undefined;
+  private nextId = 0;
+  private pending: Map<number, PendingEncode> = new Map();
+
+  /**
+   * codec and level configure the compression applied by the worker after
+   * serialization; they default to gzip at the default level.
+   */
+  constructor(
+    private codec?: CompressionCodec,
+    private level?: number
+  ) {}
+
+  /**
+   * Serializes and compresses the profile on the worker thread, returning the
+   * compressed bytes. If the worker cannot be started or fails, the returned
+   * promise rejects and the caller is expected to fall back to encoding on
+   * the main thread.
+   *
+   * When cacheKey is given, the worker encodes incrementally: table entries
+   * unchanged since the previous profile with the same key reuse their
+   * already-serialized bytes.
+   */
+  encode(
+    profile: perftools.profiles.IProfile,
+    cacheKey?: string
+  ): Promise<Buffer> {
+    const worker = this.getWorker();
+    const id = this.nextId++;
+    return new Promise<Buffer>((resolve, reject) => {
+      this.pending.set(id, {resolve, reject});
+      // Keep the event loop alive while an encode is outstanding, since the
+      // worker is otherwise unref'd.
+      worker.ref();
+      worker.postMessage({id, profile, cacheKey});
+    });
+  }
+
+  /**
+   * Terminates the worker, rejecting any outstanding encodes.
+   */
+  stop(): void {
+    if (this.worker) {
+      this.worker.terminate();
+      this.worker = undefined;
+    }
+    this.failAll(new Error('Encoder pool stopped.'));
+  }
+
+  private getWorker(): Worker {
+    if (!this.worker) {
+      const worker = new Worker(require.resolve('./encode-worker.js'), {
+        workerData: {codec: this.codec, level: this.level},
+      });
+      worker.on('message', (message: EncodeResponse) => {
+        const pending = this.pending.get(message.id);
+        if (!pending) {
+          return;
+        }
+        this.pending.delete(message.id);
+        if (this.pending.size === 0) {
+          worker.unref();
+        }
+        if (message.error !== undefined || message.bytes === undefined) {
+          pending.reject(
+            new Error(message.error || 'Profile encoding failed.')
+          );
+          return;
+        }
+        pending.resolve(Buffer.from(message.bytes));
+      });
+      worker.on('error', (err: Error) => {
+        // The worker is no longer usable; a new one will be created on the
+        // next encode.
+        this.worker = undefined;
+        this.failAll(err);
+      });
+      worker.on('exit', () => {
+        if (this.worker === worker) {
+          this.worker = undefined;
+        }
+        this.failAll(new Error('Encode worker exited unexpectedly.'));
+      });
+      worker.unref();
+      this.worker = worker;
+    }
+    return this.worker;
+  }
+
+  private failAll(err: Error) {
+    const pending = Array.from(this.pending.values());
+    this.pending.clear();
+    pending.forEach(p => p.reject(err));
+  }
+}
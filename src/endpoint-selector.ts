@@ -0,0 +1,104 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Cool-down applied to an endpoint after a failure; doubles with each
+// consecutive failure, up to the cap, after which the endpoint is
+// eligible again.
+const UNHEALTHY_BASE_MILLIS = 60 * 1000;
+const UNHEALTHY_CAP_MILLIS = 10 * 60 * 1000;
+
+interface EndpointHealth {
+  consecutiveFailures: number;
+  unhealthyUntilMillis: number;
+}
+
+/**
+ * Tracks the health of a prioritized list of API endpoints. The primary
+ * choice is the highest-priority endpoint not cooling down after recent
+ * failures; a fallback is the next such endpoint, used for failover and
+ * hedged requests. An endpoint's cool-down grows with consecutive
+ * failures and resets on success, so traffic returns to the preferred
+ * endpoint once it recovers.
+ *
+ * Public for testing.
+ */
+export class EndpointSelector {
+  private health: Map<string, EndpointHealth> = new Map();
+
+  constructor(readonly endpoints: string[]) {
+    for (const endpoint of endpoints) {
+      this.health.set(endpoint, {
+        consecutiveFailures: 0,
+        unhealthyUntilMillis: 0,
+      });
+    }
+  }
+
+  /**
+   * @return the highest-priority endpoint considered healthy; when all
+   * endpoints are cooling down, the highest-priority one regardless.
+   */
+  primary(): string {
+    const now = Date.now();
+    for (const endpoint of this.endpoints) {
+      if (this.health.get(endpoint)!.unhealthyUntilMillis <= now) {
+        return endpoint;
+      }
+    }
+    return this.endpoints[0];
+  }
+
+  /**
+   * @return the highest-priority healthy endpoint other than excluded,
+   * falling back to any other endpoint, or undefined when only one
+   * endpoint is configured.
+   */
+  fallback(excluded: string): string | undefined {
+    const now = Date.now();
+    let any: string | undefined;
+    for (const endpoint of this.endpoints) {
+      if (endpoint === excluded) {
+        continue;
+      }
+      if (this.health.get(endpoint)!.unhealthyUntilMillis <= now) {
+        return endpoint;
+      }
+      if (any === undefined) {
+        any = endpoint;
+      }
+    }
+    return any;
+  }
+
+  markSuccess(endpoint: string): void {
+    const health = this.health.get(endpoint);
+    if (health) {
+      health.consecutiveFailures = 0;
+      health.unhealthyUntilMillis = 0;
+    }
+  }
+
+  markFailure(endpoint: string): void {
+    const health = this.health.get(endpoint);
+    if (!health) {
+      return;
+    }
+    health.consecutiveFailures++;
+    const coolDown = Math.min(
+      UNHEALTHY_BASE_MILLIS * Math.pow(2, health.consecutiveFailures - 1),
+      UNHEALTHY_CAP_MILLIS
+    );
+    health.unhealthyUntilMillis = Date.now() + coolDown;
+  }
+}
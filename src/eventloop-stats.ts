@@ -0,0 +1,89 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Samples event loop delay and event loop utilization over one time
+ * profiling window, so "was the event loop saturated while this profile
+ * was taken?" can be answered from the profile itself instead of a
+ * separate metrics system. stop() reports the aggregates as profile label
+ * values; measurement costs one histogram and two utilization reads per
+ * window.
+ *
+ * Each metric is included only when the running Node version provides its
+ * perf_hooks API (monitorEventLoopDelay for lag, Node 11.10 and later;
+ * performance.eventLoopUtilization for ELU, Node 12.19 and later). On
+ * versions with neither, stop() reports no labels.
+ *
+ * Public for testing.
+ */
+export class EventLoopStatsSampler {
+  // Histogram from perf_hooks.monitorEventLoopDelay; typed loosely since
+  // the API is not present in all supported Node versions.
+  // eslint-disable-next-line @typescript-eslint/no-explicit-any
+  private histogram: any | undefined;
+  // eslint-disable-next-line @typescript-eslint/no-explicit-any
+  private eventLoopUtilization: ((previous?: any) => any) | undefined;
+  // ELU snapshot taken at the start of the window.
+  // eslint-disable-next-line @typescript-eslint/no-explicit-any
+  private eluStart: any;
+
+  constructor() {
+    // eslint-disable-next-line @typescript-eslint/no-var-requires
+    const perfHooks = require('perf_hooks');
+    if (typeof perfHooks.monitorEventLoopDelay === 'function') {
+      this.histogram = perfHooks.monitorEventLoopDelay({resolution: 20});
+    }
+    if (
+      perfHooks.performance &&
+      typeof perfHooks.performance.eventLoopUtilization === 'function'
+    ) {
+      this.eventLoopUtilization =
+        perfHooks.performance.eventLoopUtilization.bind(perfHooks.performance);
+    }
+  }
+
+  /** Begins an observation window. */
+  start(): void {
+    if (this.histogram) {
+      this.histogram.reset();
+      this.histogram.enable();
+    }
+    if (this.eventLoopUtilization) {
+      this.eluStart = this.eventLoopUtilization();
+    }
+  }
+
+  /**
+   * Ends the window begun by start() and returns its aggregates as label
+   * values: median and maximum event loop lag in milliseconds, and the
+   * fraction of the window the event loop spent active.
+   */
+  stop(): {[key: string]: string} {
+    const labels: {[key: string]: string} = {};
+    if (this.histogram) {
+      this.histogram.disable();
+      // Histogram values are reported in nanoseconds.
+      labels['event_loop_lag_p50_ms'] = (
+        this.histogram.percentile(50) / 1e6
+      ).toFixed(2);
+      labels['event_loop_lag_max_ms'] = (this.histogram.max / 1e6).toFixed(2);
+    }
+    if (this.eventLoopUtilization) {
+      labels['event_loop_utilization'] = this.eventLoopUtilization(
+        this.eluStart
+      ).utilization.toFixed(3);
+    }
+    return labels;
+  }
+}
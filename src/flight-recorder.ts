@@ -0,0 +1,128 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as fs from 'fs';
+import * as path from 'path';
+import {promisify} from 'util';
+
+const mkdir = promisify(fs.mkdir);
+const readdir = promisify(fs.readdir);
+const stat = promisify(fs.stat);
+const unlink = promisify(fs.unlink);
+const writeFile = promisify(fs.writeFile);
+
+// Total on-disk budget used when none is configured.
+const DEFAULT_MAX_BYTES = 64 * 1024 * 1024;
+
+interface RecordedFile {
+  file: string;
+  bytes: number;
+}
+
+/**
+ * Keeps the most recent profiles on disk: each recorded profile is written
+ * as one compressed pprof file under a directory, and the oldest files are
+ * deleted once the directory exceeds its size budget, so the directory
+ * always holds a rolling window of the last profiles collected. Files are
+ * named profile-<millis>-<seq>-<type>.<ext> and sort oldest-first by name;
+ * each one is directly consumable by pprof tooling.
+ *
+ * All I/O is asynchronous and best-effort: a failed write or delete is
+ * logged through the provided hook and otherwise ignored, so recording
+ * never disturbs the profiled application. Writes and deletions are
+ * chained, so concurrent record() calls cannot interleave evictions.
+ *
+ * Public for testing.
+ */
+export class FlightRecorder {
+  private maxBytes: number;
+  private files: RecordedFile[] = [];
+  private totalBytes = 0;
+  private sequence = 0;
+  // Chains record() calls; also gates them on the initial directory scan.
+  private lastOp: Promise<void>;
+
+  constructor(
+    readonly dir: string,
+    maxBytes?: number,
+    private log: (message: string) => void = () => {}
+  ) {
+    this.maxBytes = maxBytes === undefined ? DEFAULT_MAX_BYTES : maxBytes;
+    this.lastOp = this.init();
+  }
+
+  /**
+   * Writes a profile of the given type, already compressed, to the
+   * recording directory and evicts the oldest files if the directory now
+   * exceeds its budget. The returned promise resolves once the write and
+   * any evictions have settled; callers need not wait for it.
+   */
+  record(
+    profileType: string,
+    bytes: Buffer,
+    extension = 'pb.gz'
+  ): Promise<void> {
+    this.lastOp = this.lastOp.then(async () => {
+      const file = path.join(
+        this.dir,
+        `profile-${Date.now()}-${this.sequence++}-` +
+          `${profileType.toLowerCase()}.${extension}`
+      );
+      try {
+        await writeFile(file, bytes);
+      } catch (err) {
+        this.log(`Failed to record profile to ${file}: ${err}`);
+        return;
+      }
+      this.files.push({file, bytes: bytes.length});
+      this.totalBytes += bytes.length;
+      await this.evict();
+    });
+    return this.lastOp;
+  }
+
+  /**
+   * Creates the recording directory and seeds the size ledger from files
+   * left by a previous run, so the budget covers restarts too.
+   */
+  private async init(): Promise<void> {
+    try {
+      await mkdir(this.dir, {recursive: true});
+      const names = (await readdir(this.dir))
+        .filter(f => f.startsWith('profile-'))
+        .sort();
+      for (const name of names) {
+        const file = path.join(this.dir, name);
+        const {size} = await stat(file);
+        this.files.push({file, bytes: size});
+        this.totalBytes += size;
+      }
+      await this.evict();
+    } catch (err) {
+      this.log(`Failed to initialize flight recorder in ${this.dir}: ${err}`);
+    }
+  }
+
+  private async evict(): Promise<void> {
+    while (this.totalBytes > this.maxBytes && this.files.length > 1) {
+      const oldest = this.files.shift()!;
+      this.totalBytes -= oldest.bytes;
+      try {
+        await unlink(oldest.file);
+      } catch (err) {
+        this.log(`Failed to evict recorded profile ${oldest.file}: ${err}`);
+      }
+    }
+  }
+}
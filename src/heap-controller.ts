@@ -0,0 +1,94 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Fraction of each adjustment applied per cycle; the rest of the previous
+// interval is kept, damping reactions to one-off allocation spikes.
+const SMOOTHING = 0.5;
+
+// Bounds of the adjusted interval relative to the configured interval.
+const MIN_INTERVAL_SCALE = 1 / 16;
+const MAX_INTERVAL_SCALE = 16;
+
+// Minimum relative change before a new interval is reported. Restarting
+// the heap sampler discards its accumulated samples, so small corrections
+// are not worth a restart.
+const MIN_RELATIVE_CHANGE = 0.2;
+
+/**
+ * Closed-loop controller for the heap profiler's sampling interval.
+ *
+ * After each heap profile the agent reports the number of samples it
+ * contained; the controller compares that to the configured target and
+ * computes the interval which would have produced the target count at the
+ * observed allocation rate. Adjustments are damped and bounded, and an
+ * adjustment is only reported when it is large enough to justify
+ * restarting the sampler.
+ *
+ * Public for testing.
+ */
+export class HeapIntervalController {
+  private intervalBytes: number;
+
+  /**
+   * @param baseIntervalBytes - the configured sampling interval, the
+   * starting point and scale anchor for adjustments.
+   * @param targetSampleCount - desired number of samples per heap profile.
+   */
+  constructor(
+    readonly baseIntervalBytes: number,
+    readonly targetSampleCount: number
+  ) {
+    this.intervalBytes = baseIntervalBytes;
+  }
+
+  /**
+   * @return the sampling interval, in bytes, the controller currently
+   * considers correct.
+   */
+  currentIntervalBytes(): number {
+    return Math.round(this.intervalBytes);
+  }
+
+  /**
+   * Records the sample count of one heap profile and adjusts the interval
+   * toward the configured target count.
+   *
+   * @param sampleCount - number of samples in the collected profile.
+   * @return the new interval, in bytes, when the change is large enough to
+   * warrant restarting the sampler, and undefined otherwise.
+   */
+  record(sampleCount: number): number | undefined {
+    if (sampleCount <= 0) {
+      return undefined;
+    }
+    // Sample count is proportional to allocated bytes over the interval,
+    // so scaling the interval by observed/target count moves the next
+    // profile onto the target at the observed allocation rate.
+    const scale = sampleCount / this.targetSampleCount;
+    const adjusted = this.intervalBytes * scale;
+    const next = SMOOTHING * adjusted + (1 - SMOOTHING) * this.intervalBytes;
+
+    const bounded = Math.min(
+      Math.max(next, MIN_INTERVAL_SCALE * this.baseIntervalBytes),
+      MAX_INTERVAL_SCALE * this.baseIntervalBytes
+    );
+    const relativeChange =
+      Math.abs(bounded - this.intervalBytes) / this.intervalBytes;
+    this.intervalBytes = bounded;
+    if (relativeChange < MIN_RELATIVE_CHANGE) {
+      return undefined;
+    }
+    return Math.round(bounded);
+  }
+}
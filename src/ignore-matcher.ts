@@ -0,0 +1,138 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import type {perftools} from '../protos/profile';
+
+/**
+ * Matches a set of substring patterns in a single pass over the input
+ * (Aho-Corasick), so the cost of matching does not grow with the number
+ * of patterns the way repeated indexOf scans would. Patterns are compiled
+ * once, at construction.
+ *
+ * Public for testing.
+ */
+export class IgnoreMatcher {
+  // Trie with failure links, stored flat: transitions[s] maps a character
+  // code to the next state, failure[s] is the fallback state, and
+  // terminal[s] is true when some pattern ends at or suffixes state s.
+  private transitions: Array<Map<number, number>> = [new Map()];
+  private failure: number[] = [0];
+  private terminal: boolean[] = [false];
+
+  constructor(patterns: string[]) {
+    for (const pattern of patterns) {
+      if (pattern.length === 0) {
+        continue;
+      }
+      let state = 0;
+      for (let i = 0; i < pattern.length; i++) {
+        const c = pattern.charCodeAt(i);
+        let next = this.transitions[state].get(c);
+        if (next === undefined) {
+          next = this.transitions.length;
+          this.transitions.push(new Map());
+          this.failure.push(0);
+          this.terminal.push(false);
+          this.transitions[state].set(c, next);
+        }
+        state = next;
+      }
+      this.terminal[state] = true;
+    }
+
+    // Breadth-first construction of failure links; a state inherits
+    // terminality from its failure state so matches ending mid-pattern of
+    // another pattern are still found.
+    const queue: number[] = Array.from(this.transitions[0].values());
+    while (queue.length > 0) {
+      const state = queue.shift()!;
+      for (const [c, child] of this.transitions[state]) {
+        queue.push(child);
+        let f = this.failure[state];
+        while (f !== 0 && !this.transitions[f].has(c)) {
+          f = this.failure[f];
+        }
+        const candidate = this.transitions[f].get(c);
+        this.failure[child] =
+          candidate !== undefined && candidate !== child ? candidate : 0;
+        if (this.terminal[this.failure[child]]) {
+          this.terminal[child] = true;
+        }
+      }
+    }
+  }
+
+  /** @return true when any pattern occurs as a substring of s. */
+  matches(s: string): boolean {
+    let state = 0;
+    for (let i = 0; i < s.length; i++) {
+      const c = s.charCodeAt(i);
+      let next = this.transitions[state].get(c);
+      while (next === undefined && state !== 0) {
+        state = this.failure[state];
+        next = this.transitions[state].get(c);
+      }
+      state = next === undefined ? 0 : next;
+      if (this.terminal[state]) {
+        return true;
+      }
+    }
+    return false;
+  }
+}
+
+/**
+ * Drops from p every sample with a stack frame whose file name matches
+ * the matcher. The matcher runs once per string table entry rather than
+ * once per frame, so filtering cost is bounded by the table size, not the
+ * sample count.
+ *
+ * Public for testing.
+ */
+export function removeIgnoredSamples(
+  p: perftools.profiles.IProfile,
+  matcher: IgnoreMatcher
+): void {
+  if (!p.sample || !p.stringTable) {
+    return;
+  }
+  const ignoredStrings = new Set<string>();
+  p.stringTable.forEach((s, i) => {
+    if (matcher.matches(s)) {
+      ignoredStrings.add(String(i));
+    }
+  });
+  if (ignoredStrings.size === 0) {
+    return;
+  }
+  const ignoredFunctions = new Set<string>();
+  for (const fn of p['function'] || []) {
+    if (fn.filename != null && ignoredStrings.has(String(fn.filename))) {
+      ignoredFunctions.add(String(fn.id));
+    }
+  }
+  const ignoredLocations = new Set<string>();
+  for (const location of p.location || []) {
+    for (const line of location.line || []) {
+      if (ignoredFunctions.has(String(line.functionId))) {
+        ignoredLocations.add(String(location.id));
+        break;
+      }
+    }
+  }
+  p.sample = p.sample.filter(
+    sample =>
+      !(sample.locationId || []).some(id => ignoredLocations.has(String(id)))
+  );
+}
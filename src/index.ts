@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+import * as cluster from 'cluster';
 import delay from 'delay';
 import * as extend from 'extend';
 import * as fs from 'fs';
@@ -19,9 +20,20 @@ import * as gcpMetadata from 'gcp-metadata';
 import {heap as heapProfiler} from 'pprof';
 import * as semver from 'semver';
 
+import {
+  clusterCollectDelegate,
+  startClusterWorker,
+} from './cluster-coordinator';
+import {codecFileExtension} from './compression';
 import {Config, defaultConfig, LocalConfig, ProfilerConfig} from './config';
+import {FlightRecorder} from './flight-recorder';
 import {createLogger} from './logger';
-import {Profiler} from './profiler';
+import {Metrics} from './metrics';
+import {Profiler, RequestProfile} from './profiler';
+
+// Merging utility for services which profile several worker threads and
+// want one upload per process instead of one per thread.
+export {mergeProfiles, ProfileToMerge} from './profile-merger';
 
 // eslint-disable-next-line @typescript-eslint/no-var-requires
 const pjson = require('../../package.json');
@@ -113,7 +125,7 @@ function initConfigLocal(config: Config): LocalConfig {
 async function initConfigMetadata(
   config: LocalConfig
 ): Promise<ProfilerConfig> {
-  const logger = createLogger(config.logLevel);
+  const logger = createLogger(config.logLevel, config.asyncLogging);
   const getMetadataProperty = async (
     f: (s: string) => Promise<string>,
     field: string
@@ -190,6 +202,15 @@ export async function createProfiler(config: Config = {}): Promise<Profiler> {
       localConfig.heapMaxStackDepth
     );
   }
+  // With deferMetadata, the profiler is constructed with the locally known
+  // config and the metadata fetches complete in the background; the first
+  // poll to the profiler server waits for them.
+  if (localConfig.deferMetadata) {
+    const profiler = new Profiler(localConfig as ProfilerConfig);
+    profiler.setConfigMetadata(initConfigMetadata(localConfig));
+    return profiler;
+  }
+
   let profilerConfig: ProfilerConfig;
   try {
     profilerConfig = await initConfigMetadata(localConfig);
@@ -215,19 +236,101 @@ export async function createProfiler(config: Config = {}): Promise<Profiler> {
  *
  */
 export async function start(config: Config = {}): Promise<void> {
+  // In cluster coordinator mode, workers only listen for collection
+  // requests from the primary; the primary runs the full agent but
+  // delegates collection to the workers.
+  if (config.clusterProfiling && cluster.isWorker) {
+    startClusterWorker(initConfigLocal(config));
+    return;
+  }
   const profiler = await createProfiler(config);
+  if (config.clusterProfiling && cluster.isMaster) {
+    profiler.collectDelegate = clusterCollectDelegate(profiler.config);
+  }
+  activeProfiler = profiler;
   profiler.start();
 }
 
+// Profiler started by start(), kept so stop() can reach it.
+let activeProfiler: Profiler | undefined;
+
+/**
+ * Stops the profiling agent started with start(): the in-flight poll to
+ * the profiler server is cancelled and no further profiles are collected
+ * or uploaded, so an otherwise-idle process is free to exit. Intended for
+ * graceful shutdown paths of batch jobs and scale-to-zero deployments.
+ * Profiling resumes if start() is called again.
+ */
+export function stop(): void {
+  if (activeProfiler) {
+    activeProfiler.stop();
+    activeProfiler = undefined;
+  }
+}
+
+/**
+ * Retunes the heap sampler of the agent started with start() to a new
+ * average sampling interval, in bytes, without a process restart. Useful
+ * when allocation rates vary widely over time and a single interval is
+ * either too coarse or too costly. Samples accumulated under the previous
+ * interval are discarded. See also the heapTargetSampleCount config
+ * option, which automates this adjustment. No-op when the agent is not
+ * started or heap profiling is disabled.
+ */
+export function setHeapSamplingInterval(intervalBytes: number): void {
+  if (activeProfiler) {
+    activeProfiler.setHeapSamplingInterval(intervalBytes);
+  }
+}
+
+/**
+ * Returns a snapshot of the self-telemetry of the agent started with
+ * start(): counters and timing distributions for profile collection,
+ * serialization and upload. Returns undefined when the agent is not
+ * started. See also the metricsCallback config option, which delivers a
+ * snapshot after each profiling cycle.
+ */
+export function getMetrics(): Metrics | undefined {
+  return activeProfiler ? activeProfiler.getMetrics() : undefined;
+}
+
 /**
- * For debugging purposes. Collects profiles and discards the collected
- * profiles.
+ * Collects profiles without talking to the profiler API. By default the
+ * collected profiles are discarded, for debugging purposes; with
+ * flightRecorderPath set they are recorded to a size-capped directory of
+ * rotating pprof files, giving environments with no route to the API a
+ * rolling on-disk window of recent profiles.
  */
 export async function startLocal(config: Config = {}): Promise<void> {
   const profiler = await createProfiler(config);
+  activeProfiler = profiler;
 
   // Set up periodic logging.
-  const logger = createLogger(config.logLevel);
+  const logger = createLogger(config.logLevel, config.asyncLogging);
+
+  const recorder = profiler.config.flightRecorderPath
+    ? new FlightRecorder(
+        profiler.config.flightRecorderPath,
+        profiler.config.flightRecorderMaxBytes,
+        message => logger.debug(message)
+      )
+    : undefined;
+  const recordExtension = codecFileExtension(profiler.config.compressionCodec);
+  const recordProfile = (prof: RequestProfile) => {
+    if (!recorder) {
+      return;
+    }
+    // Profiles arrive already serialized and compressed by the regular
+    // encode paths; recording is just a write.
+    const bytes = prof.rawProfileBytes
+      ? prof.rawProfileBytes
+      : prof.profileBytes
+      ? Buffer.from(prof.profileBytes, 'base64')
+      : undefined;
+    if (bytes) {
+      recorder.record(prof.profileType || 'profile', bytes, recordExtension);
+    }
+  };
 
   let heapProfileCount = 0;
   let timeProfileCount = 0;
@@ -263,19 +366,23 @@ export async function startLocal(config: Config = {}): Promise<void> {
   // Periodic profiling
   setInterval(async () => {
     if (!config.disableHeap) {
-      await profiler.profile({
-        name: 'Heap-Profile' + new Date(),
-        profileType: 'HEAP',
-      });
+      recordProfile(
+        await profiler.profile({
+          name: 'Heap-Profile' + new Date(),
+          profileType: 'HEAP',
+        })
+      );
       heapProfileCount++;
     }
     await delay(profiler.config.localProfilingPeriodMillis / 2);
     if (!config.disableTime) {
-      await profiler.profile({
-        name: 'Time-Profile' + new Date(),
-        profileType: 'WALL',
-        duration: profiler.config.localTimeDurationMillis.toString() + 'ms',
-      });
+      recordProfile(
+        await profiler.profile({
+          name: 'Time-Profile' + new Date(),
+          profileType: 'WALL',
+          duration: profiler.config.localTimeDurationMillis.toString() + 'ms',
+        })
+      );
       timeProfileCount++;
     }
   }, profiler.config.localProfilingPeriodMillis);
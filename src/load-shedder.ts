@@ -0,0 +1,70 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Lag is judged at this percentile of the delay histogram, so brief
+// one-off stalls do not trip the gate but sustained saturation does.
+const LAG_PERCENTILE = 90;
+
+/**
+ * Backpressure gate for profile collection, driven by the event loop delay
+ * histogram from perf_hooks. When the observed lag since the last check
+ * exceeds the configured threshold, collection should be deferred to the
+ * next cycle: a saturated event loop is exactly when the application can
+ * least afford the profiling and serialization cost.
+ *
+ * On Node versions without monitorEventLoopDelay the gate never trips.
+ *
+ * Public for testing.
+ */
+export class LoadShedder {
+  // Histogram from perf_hooks.monitorEventLoopDelay; typed loosely since
+  // the API is not present in all supported Node versions.
+  // eslint-disable-next-line @typescript-eslint/no-explicit-any
+  private histogram: any | undefined;
+
+  constructor(readonly maxEventLoopLagMillis: number) {
+    // eslint-disable-next-line @typescript-eslint/no-var-requires
+    const perfHooks = require('perf_hooks');
+    if (typeof perfHooks.monitorEventLoopDelay === 'function') {
+      this.histogram = perfHooks.monitorEventLoopDelay({resolution: 20});
+      this.histogram.enable();
+    }
+  }
+
+  /**
+   * @return event loop lag, in ms, observed since the last call to
+   * shouldShed(), or 0 when the delay histogram is unsupported.
+   */
+  currentLagMillis(): number {
+    if (!this.histogram) {
+      return 0;
+    }
+    // Histogram values are reported in nanoseconds.
+    return this.histogram.percentile(LAG_PERCENTILE) / 1e6;
+  }
+
+  /**
+   * @return true iff collection should be deferred because the event loop
+   * is saturated. Resets the observation window, so each decision reflects
+   * the lag since the previous one.
+   */
+  shouldShed(): boolean {
+    if (!this.histogram) {
+      return false;
+    }
+    const lagMillis = this.currentLagMillis();
+    this.histogram.reset();
+    return lagMillis > this.maxEventLoopLagMillis;
+  }
+}
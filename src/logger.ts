@@ -13,6 +13,8 @@
 // limitations under the License.
 
 import * as consoleLogLevel from 'console-log-level';
+import * as util from 'util';
+
 import {defaultConfig} from './config';
 
 // eslint-disable-next-line @typescript-eslint/no-var-requires
@@ -27,18 +29,163 @@ const LEVEL_NAMES: consoleLogLevel.LogLevelNames[] = [
   'trace',
 ];
 
-function logLevelToName(level?: number): consoleLogLevel.LogLevelNames {
+// How long buffered lines may wait before a flush is forced.
+const FLUSH_DELAY_MILLIS = 100;
+
+// Lines buffered beyond this are dropped (and counted) rather than
+// growing the buffer without bound while the sink is slow.
+const MAX_BUFFERED_LINES = 1000;
+
+function clampLogLevel(level?: number): number {
   if (level === undefined) {
-    level = defaultConfig.logLevel;
-  } else if (level < 0) {
-    level = 0;
-  } else if (level > 4) {
-    level = 4;
+    return defaultConfig.logLevel;
+  }
+  return Math.max(0, Math.min(4, level));
+}
+
+function logLevelToName(level?: number): consoleLogLevel.LogLevelNames {
+  return LEVEL_NAMES[clampLogLevel(level)];
+}
+
+/**
+ * Log sink which buffers structured lines in memory and writes them out
+ * asynchronously in batches, so logging never performs a synchronous
+ * write on the caller's stack. console.log through a piped stdio stream
+ * blocks the event loop whenever the consumer backpressures; with this
+ * sink a slow log pipeline delays log delivery instead of the profiled
+ * application. When the buffer is full, further lines are dropped and
+ * counted, and the count is reported in the next flushed batch.
+ *
+ * Public for testing.
+ */
+export class BatchedLogSink {
+  private lines: string[] = [];
+  private droppedLines = 0;
+  private flushTimer: NodeJS.Timeout | undefined;
+  // Serializes flushes so batches cannot interleave on the stream.
+  private lastFlush: Promise<void> = Promise.resolve();
+
+  constructor(
+    private writeOut: (
+      chunk: string,
+      callback: (err?: Error | null) => void
+    ) => void = (chunk, callback) => {
+      process.stderr.write(chunk, callback);
+    },
+    private maxBufferedLines = MAX_BUFFERED_LINES
+  ) {}
+
+  /** Buffers one structured line and schedules a flush. */
+  log(severity: string, message: string): void {
+    if (this.lines.length >= this.maxBufferedLines) {
+      this.droppedLines++;
+      return;
+    }
+    this.lines.push(
+      JSON.stringify({
+        time: new Date().toISOString(),
+        severity,
+        name: pjson.name,
+        message,
+      }) + '\n'
+    );
+    if (!this.flushTimer) {
+      this.flushTimer = setTimeout(() => {
+        this.flushTimer = undefined;
+        this.flush();
+      }, FLUSH_DELAY_MILLIS);
+      // A pending batch must not keep an otherwise-idle process alive.
+      this.flushTimer.unref();
+    }
+  }
+
+  /**
+   * Writes all buffered lines as one batch. The returned promise resolves
+   * once the write has been accepted by the stream; callers other than
+   * tests and exit hooks need not wait for it.
+   */
+  flush(): Promise<void> {
+    if (this.flushTimer) {
+      clearTimeout(this.flushTimer);
+      this.flushTimer = undefined;
+    }
+    this.lastFlush = this.lastFlush.then(
+      () =>
+        new Promise<void>(resolve => {
+          if (this.droppedLines > 0) {
+            this.lines.push(
+              JSON.stringify({
+                time: new Date().toISOString(),
+                severity: 'warn',
+                name: pjson.name,
+                message: `Dropped ${this.droppedLines} log lines: log buffer full.`,
+              }) + '\n'
+            );
+            this.droppedLines = 0;
+          }
+          if (this.lines.length === 0) {
+            resolve();
+            return;
+          }
+          const batch = this.lines.join('');
+          this.lines = [];
+          // Write failures are ignored; there is nowhere left to report
+          // them.
+          this.writeOut(batch, () => resolve());
+        })
+    );
+    return this.lastFlush;
   }
-  return LEVEL_NAMES[level];
 }
 
-export function createLogger(level?: number) {
+/**
+ * Builds a console-log-level-compatible logger backed by sink. Messages
+ * are formatted eagerly (so later mutation of logged objects cannot
+ * change them) but written asynchronously.
+ *
+ * Public for testing.
+ */
+export function makeBatchedLogger(
+  level: number | undefined,
+  sink: BatchedLogSink
+): consoleLogLevel.Logger {
+  const maxSeverity = clampLogLevel(level);
+  const logger: Partial<consoleLogLevel.Logger> = {};
+  LEVEL_NAMES.forEach((name, severity) => {
+    logger[name] =
+      severity <= maxSeverity
+        ? // eslint-disable-next-line @typescript-eslint/no-explicit-any
+          (...args: any[]) => sink.log(name, util.format(...args))
+        : () => {};
+  });
+  return logger as consoleLogLevel.Logger;
+}
+
+// Sink shared by every async logger of the process, so all components
+// batch into one stream and the exit-time flush is registered once.
+let sharedSink: BatchedLogSink | undefined;
+
+function getSharedSink(): BatchedLogSink {
+  if (!sharedSink) {
+    sharedSink = new BatchedLogSink();
+    const sink = sharedSink;
+    process.on('beforeExit', () => {
+      sink.flush();
+    });
+  }
+  return sharedSink;
+}
+
+/**
+ * Returns the agent's logger. By default log lines go through
+ * console-log-level, which writes synchronously; with asyncLogging they
+ * are buffered and flushed in asynchronous structured batches instead
+ * (see the asyncLogging config option).
+ */
+export function createLogger(level?: number, asyncLogging?: boolean) {
+  if (asyncLogging) {
+    return makeBatchedLogger(level, getSharedSink());
+  }
   return consoleLogLevel({
     stderr: true,
     prefix: pjson.name,
@@ -0,0 +1,127 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Point-in-time summary of one timing distribution kept by the agent.
+ * Millisecond values; minMillis, maxMillis and meanMillis are 0 when no
+ * value has been recorded.
+ */
+export interface TimingSummary {
+  count: number;
+  totalMillis: number;
+  minMillis: number;
+  maxMillis: number;
+  meanMillis: number;
+}
+
+/**
+ * Snapshot of the agent's self-telemetry, returned by
+ * Profiler.getMetrics() and passed to the metricsCallback config hook.
+ * Counters are cumulative since the profiler was constructed.
+ */
+export interface Metrics {
+  // Number of profiles collected, by success of the collection itself.
+  profilesCollected: number;
+  collectionErrors: number;
+
+  // Number of profiles uploaded, and the cumulative size of the upload
+  // request bodies.
+  profilesUploaded: number;
+  uploadedBytes: number;
+
+  // Uploads which failed outright, and profiles queued for a retry after
+  // a retriable failure.
+  uploadErrors: number;
+  uploadsRetried: number;
+
+  // Backoffs taken before re-asking the server to create a profile,
+  // whether server-specified or from the local retryer.
+  createProfileBackoffs: number;
+
+  // Wall time of profile collection; for time profiles this includes the
+  // profiled window itself.
+  collectMillis: TimingSummary;
+
+  // Wall time of profile serialization and compression, one value per
+  // profile, covering encode and gzip together (they run as one step on
+  // the worker path).
+  serializeMillis: TimingSummary;
+
+  // Wall time of upload requests, including queued retries.
+  uploadMillis: TimingSummary;
+}
+
+class Timing {
+  private count = 0;
+  private totalMillis = 0;
+  private minMillis = 0;
+  private maxMillis = 0;
+
+  record(millis: number): void {
+    if (this.count === 0 || millis < this.minMillis) {
+      this.minMillis = millis;
+    }
+    if (millis > this.maxMillis) {
+      this.maxMillis = millis;
+    }
+    this.count++;
+    this.totalMillis += millis;
+  }
+
+  summary(): TimingSummary {
+    return {
+      count: this.count,
+      totalMillis: this.totalMillis,
+      minMillis: this.minMillis,
+      maxMillis: this.maxMillis,
+      meanMillis: this.count === 0 ? 0 : this.totalMillis / this.count,
+    };
+  }
+}
+
+/**
+ * Mutable counters and timings behind the Metrics snapshot. Recording is
+ * cheap (a few additions), so instrumentation points do not need to be
+ * guarded.
+ *
+ * Public for testing.
+ */
+export class AgentMetrics {
+  profilesCollected = 0;
+  collectionErrors = 0;
+  profilesUploaded = 0;
+  uploadedBytes = 0;
+  uploadErrors = 0;
+  uploadsRetried = 0;
+  createProfileBackoffs = 0;
+
+  readonly collect = new Timing();
+  readonly serialize = new Timing();
+  readonly upload = new Timing();
+
+  snapshot(): Metrics {
+    return {
+      profilesCollected: this.profilesCollected,
+      collectionErrors: this.collectionErrors,
+      profilesUploaded: this.profilesUploaded,
+      uploadedBytes: this.uploadedBytes,
+      uploadErrors: this.uploadErrors,
+      uploadsRetried: this.uploadsRetried,
+      createProfileBackoffs: this.createProfileBackoffs,
+      collectMillis: this.collect.summary(),
+      serializeMillis: this.serialize.summary(),
+      uploadMillis: this.upload.summary(),
+    };
+  }
+}
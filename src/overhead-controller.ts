@@ -0,0 +1,94 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Estimated cost of taking and recording one sample with the V8 sampling
+// profiler, used to attribute sampling overhead to a cycle.
+export const SAMPLE_COST_MICROS = 30;
+
+// The controller aims at this fraction of the overhead budget, leaving
+// headroom so noise in the measurements does not push cycles over budget.
+const TARGET_BUDGET_FRACTION = 0.8;
+
+// Fraction of each adjustment applied per cycle; the rest of the previous
+// interval is kept, damping reactions to one-off spikes.
+const SMOOTHING = 0.5;
+
+// Bounds of the adjusted interval relative to the configured interval.
+const MIN_INTERVAL_SCALE = 0.1;
+const MAX_INTERVAL_SCALE = 100;
+
+/**
+ * Closed-loop controller for the time profiler's sampling interval.
+ *
+ * After each cycle the agent reports the profiling cost it observed
+ * (sampling plus serialization); the controller compares that cost to the
+ * configured CPU overhead budget and adjusts the interval passed to the
+ * next cycle: tightening it while headroom exists and backing off when the
+ * budget is exceeded. Adjustments are damped and bounded so a single noisy
+ * cycle cannot swing the sampling rate far.
+ *
+ * Public for testing.
+ */
+export class OverheadController {
+  private intervalMicros: number;
+
+  /**
+   * @param baseIntervalMicros - the configured sampling interval, the
+   * starting point and scale anchor for adjustments.
+   * @param maxOverheadPercent - CPU overhead budget for profiling, as a
+   * percentage of the profiled window.
+   */
+  constructor(
+    readonly baseIntervalMicros: number,
+    readonly maxOverheadPercent: number
+  ) {
+    this.intervalMicros = baseIntervalMicros;
+  }
+
+  /**
+   * @return the sampling interval, in microseconds, to use for the next
+   * profiling cycle.
+   */
+  currentIntervalMicros(): number {
+    return Math.round(this.intervalMicros);
+  }
+
+  /**
+   * Records the observed cost of one profiling cycle and adjusts the
+   * sampling interval to keep overhead near, but under, the budget.
+   *
+   * @param overheadMicros - profiling cost attributed to the cycle.
+   * @param durationMicros - length of the profiled window.
+   */
+  record(overheadMicros: number, durationMicros: number): void {
+    if (durationMicros <= 0) {
+      return;
+    }
+    const overheadPercent = (100 * overheadMicros) / durationMicros;
+    const targetPercent = TARGET_BUDGET_FRACTION * this.maxOverheadPercent;
+
+    // Overhead is proportional to sample count, so inversely proportional
+    // to the interval: scaling the interval by observed/target overhead
+    // moves the next cycle onto the target.
+    const scale = Math.max(overheadPercent / targetPercent, 1e-3);
+    const adjusted = this.intervalMicros * scale;
+    const next =
+      SMOOTHING * adjusted + (1 - SMOOTHING) * this.intervalMicros;
+
+    this.intervalMicros = Math.min(
+      Math.max(next, MIN_INTERVAL_SCALE * this.baseIntervalMicros),
+      MAX_INTERVAL_SCALE * this.baseIntervalMicros
+    );
+  }
+}
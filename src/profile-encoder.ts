@@ -0,0 +1,284 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as protobuf from 'protobufjs/minimal';
+
+import {perftools} from '../protos/profile';
+
+// Pre-shifted tags (field number << 3 | wire type 2) for the repeated
+// message fields of perftools.profiles.Profile.
+const SAMPLE_TYPE_TAG = 10;
+const SAMPLE_TAG = 18;
+const MAPPING_TAG = 26;
+const LOCATION_TAG = 34;
+const FUNCTION_TAG = 42;
+const STRING_TABLE_TAG = 50;
+
+type Encoder<T> = (message: T, writer: protobuf.Writer) => protobuf.Writer;
+
+function encodeDelimited<T>(
+  tag: number,
+  encoder: Encoder<T>,
+  message: T
+): Buffer {
+  const writer = protobuf.Writer.create();
+  encoder(message, writer.uint32(tag).fork()).ldelim();
+  return Buffer.from(writer.finish());
+}
+
+function locationKey(location: perftools.profiles.ILocation): string {
+  const lines = (location.line || [])
+    .map(l => `${l.functionId}:${l.line}`)
+    .join(',');
+  return `${location.id}|${location.mappingId || 0}|${location.address ||
+    0}|${lines}`;
+}
+
+function functionKey(fn: perftools.profiles.IFunction): string {
+  return `${fn.id}|${fn.name}|${fn.systemName}|${fn.filename}|${fn.startLine ||
+    0}`;
+}
+
+/**
+ * Serializes profiles, reusing the encoded bytes of string table, function
+ * and location entries which are unchanged since the previous profile.
+ *
+ * For a steady-state service, consecutive profiles of the same type are
+ * dominated by identical table entries, so after the first profile each
+ * cycle only encodes new entries and the sample set. Entry caches are
+ * generational: entries not referenced by either of the last two profiles
+ * are dropped, bounding memory at roughly two profiles' worth of tables.
+ *
+ * Field order in the output differs from the generated encoder (cached
+ * table chunks are appended after the freshly-encoded fields), which is
+ * valid protobuf and decodes to the same profile.
+ */
+export class ProfileEncoder {
+  private strings = new GenerationalCache<string>();
+  private functions = new GenerationalCache<perftools.profiles.IFunction>();
+  private locations = new GenerationalCache<perftools.profiles.ILocation>();
+
+  encode(p: perftools.profiles.IProfile): Buffer {
+    this.strings.advance();
+    this.functions.advance();
+    this.locations.advance();
+
+    const writer = protobuf.Writer.create();
+    if (p.sampleType) {
+      for (const sampleType of p.sampleType) {
+        perftools.profiles.ValueType.encode(
+          sampleType,
+          writer.uint32(SAMPLE_TYPE_TAG).fork()
+        ).ldelim();
+      }
+    }
+    if (p.sample) {
+      for (const sample of p.sample) {
+        perftools.profiles.Sample.encode(
+          sample,
+          writer.uint32(SAMPLE_TAG).fork()
+        ).ldelim();
+      }
+    }
+    if (p.mapping) {
+      for (const mapping of p.mapping) {
+        perftools.profiles.Mapping.encode(
+          mapping,
+          writer.uint32(MAPPING_TAG).fork()
+        ).ldelim();
+      }
+    }
+
+    // Scalar and singular fields are cheap; re-encode them with the
+    // generated encoder by stripping the repeated table fields.
+    const rest: perftools.profiles.IProfile = {
+      dropFrames: p.dropFrames,
+      keepFrames: p.keepFrames,
+      timeNanos: p.timeNanos,
+      durationNanos: p.durationNanos,
+      periodType: p.periodType,
+      period: p.period,
+      comment: p.comment,
+      defaultSampleType: p.defaultSampleType,
+    };
+    const chunks: Buffer[] = [
+      Buffer.from(writer.finish()),
+      Buffer.from(perftools.profiles.Profile.encode(rest).finish()),
+    ];
+
+    if (p.location) {
+      for (const location of p.location) {
+        chunks.push(
+          this.locations.get(locationKey(location), location, loc =>
+            encodeDelimited(
+              LOCATION_TAG,
+              perftools.profiles.Location.encode,
+              loc
+            )
+          )
+        );
+      }
+    }
+    const functions = p['function'];
+    if (functions) {
+      for (const fn of functions) {
+        chunks.push(
+          this.functions.get(functionKey(fn), fn, f =>
+            encodeDelimited(FUNCTION_TAG, perftools.profiles.Function.encode, f)
+          )
+        );
+      }
+    }
+    if (p.stringTable) {
+      for (const str of p.stringTable) {
+        chunks.push(
+          this.strings.get(str, str, s => {
+            const w = protobuf.Writer.create();
+            w.uint32(STRING_TABLE_TAG).string(s);
+            return Buffer.from(w.finish());
+          })
+        );
+      }
+    }
+    return Buffer.concat(chunks);
+  }
+}
+
+// Target size of the encoded batches produced by encodeProfileChunked.
+const STREAM_BATCH_BYTES = 64 * 1024;
+
+function yieldToEventLoop(): Promise<void> {
+  return new Promise(resolve => setImmediate(resolve));
+}
+
+/**
+ * Encodes p incrementally: entries of the repeated table fields are
+ * serialized into batches of roughly STREAM_BATCH_BYTES, each full batch
+ * is handed to onBatch right away, and the encoder yields to the event
+ * loop between batches. Fed into a streaming gzip, this spreads the
+ * end-of-window serialization cost over many short turns instead of one
+ * synchronous burst. The batches concatenate to a valid encoding of p;
+ * field order differs from the generated encoder, which protobuf permits.
+ */
+export async function encodeProfileChunked(
+  p: perftools.profiles.IProfile,
+  onBatch: (batch: Buffer) => void
+): Promise<void> {
+  let writer = protobuf.Writer.create();
+  const flushIfFull = async () => {
+    if (writer.len >= STREAM_BATCH_BYTES) {
+      onBatch(Buffer.from(writer.finish()));
+      writer = protobuf.Writer.create();
+      await yieldToEventLoop();
+    }
+  };
+
+  // Scalar and singular fields are cheap; encode them all up front with
+  // the generated encoder by stripping the repeated fields.
+  const rest: perftools.profiles.IProfile = {
+    dropFrames: p.dropFrames,
+    keepFrames: p.keepFrames,
+    timeNanos: p.timeNanos,
+    durationNanos: p.durationNanos,
+    periodType: p.periodType,
+    period: p.period,
+    comment: p.comment,
+    defaultSampleType: p.defaultSampleType,
+  };
+  perftools.profiles.Profile.encode(rest, writer);
+
+  if (p.sampleType) {
+    for (const sampleType of p.sampleType) {
+      perftools.profiles.ValueType.encode(
+        sampleType,
+        writer.uint32(SAMPLE_TYPE_TAG).fork()
+      ).ldelim();
+      await flushIfFull();
+    }
+  }
+  if (p.sample) {
+    for (const sample of p.sample) {
+      perftools.profiles.Sample.encode(
+        sample,
+        writer.uint32(SAMPLE_TAG).fork()
+      ).ldelim();
+      await flushIfFull();
+    }
+  }
+  if (p.mapping) {
+    for (const mapping of p.mapping) {
+      perftools.profiles.Mapping.encode(
+        mapping,
+        writer.uint32(MAPPING_TAG).fork()
+      ).ldelim();
+      await flushIfFull();
+    }
+  }
+  if (p.location) {
+    for (const location of p.location) {
+      perftools.profiles.Location.encode(
+        location,
+        writer.uint32(LOCATION_TAG).fork()
+      ).ldelim();
+      await flushIfFull();
+    }
+  }
+  const functions = p['function'];
+  if (functions) {
+    for (const fn of functions) {
+      perftools.profiles.Function.encode(
+        fn,
+        writer.uint32(FUNCTION_TAG).fork()
+      ).ldelim();
+      await flushIfFull();
+    }
+  }
+  if (p.stringTable) {
+    for (const str of p.stringTable) {
+      writer.uint32(STRING_TABLE_TAG).string(str);
+      await flushIfFull();
+    }
+  }
+  if (writer.len > 0) {
+    onBatch(Buffer.from(writer.finish()));
+  }
+}
+
+/**
+ * Cache of encoded entry bytes with two-generation eviction: entries are
+ * promoted to the current generation on use, and the previous generation is
+ * dropped on advance().
+ */
+class GenerationalCache<T> {
+  private current: Map<string, Buffer> = new Map();
+  private previous: Map<string, Buffer> = new Map();
+
+  advance(): void {
+    this.previous = this.current;
+    this.current = new Map();
+  }
+
+  get(key: string, value: T, encode: (value: T) => Buffer): Buffer {
+    let bytes = this.current.get(key);
+    if (bytes !== undefined) {
+      return bytes;
+    }
+    bytes = this.previous.get(key);
+    if (bytes === undefined) {
+      bytes = encode(value);
+    }
+    this.current.set(key, bytes);
+    return bytes;
+  }
+}
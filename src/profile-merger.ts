@@ -0,0 +1,172 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import type {perftools} from '../protos/profile';
+
+// String table key of the label attached to merged samples.
+const THREAD_LABEL_KEY = 'thread';
+
+// eslint-disable-next-line @typescript-eslint/no-explicit-any
+function num(value: any): number {
+  if (typeof value === 'number') {
+    return value;
+  }
+  return value == null ? 0 : Number(value.toString());
+}
+
+/** One input to mergeProfiles: a profile and the thread it came from. */
+export interface ProfileToMerge {
+  profile: perftools.profiles.IProfile;
+  // Value of the "thread" label attached to this profile's samples, for
+  // example a worker thread id. When omitted, no label is added.
+  threadLabel?: string;
+}
+
+/**
+ * Merges profiles of the same type collected from multiple threads of
+ * one process into a single profile: string, function and location
+ * tables are unioned (entries identical across threads collapse to one),
+ * sample sets are concatenated with their table references remapped, and
+ * each sample is tagged with a "thread" label naming its origin. One
+ * encode, gzip and upload of the merged profile then replaces one per
+ * thread, and the server sees the process as a whole.
+ *
+ * The sample types, period and duration of the merged profile are taken
+ * from the first input; inputs are expected to cover the same profiling
+ * window with the same configuration.
+ */
+export function mergeProfiles(
+  inputs: ProfileToMerge[]
+): perftools.profiles.IProfile {
+  if (inputs.length === 0) {
+    throw new Error('Cannot merge zero profiles.');
+  }
+  const first = inputs[0].profile;
+
+  const strings: string[] = [''];
+  const stringIndexes = new Map<string, number>([['', 0]]);
+  const intern = (s: string): number => {
+    let index = stringIndexes.get(s);
+    if (index === undefined) {
+      index = strings.length;
+      strings.push(s);
+      stringIndexes.set(s, index);
+    }
+    return index;
+  };
+
+  const functions: perftools.profiles.IFunction[] = [];
+  const functionIds = new Map<string, number>();
+  const locations: perftools.profiles.ILocation[] = [];
+  const locationIds = new Map<string, number>();
+  const samples: perftools.profiles.ISample[] = [];
+
+  for (const {profile, threadLabel} of inputs) {
+    const stringTable = profile.stringTable || [];
+    const stringMap: number[] = stringTable.map(intern);
+    const remapString = (index: number | Long | null | undefined): number =>
+      stringMap[num(index)] || 0;
+
+    // Functions identical across threads (same name, file and line after
+    // string remapping) collapse to one entry with one id.
+    const functionIdMap = new Map<number, number>();
+    for (const fn of profile['function'] || []) {
+      const key = [
+        remapString(fn.name),
+        remapString(fn.systemName),
+        remapString(fn.filename),
+        num(fn.startLine),
+      ].join('|');
+      let id = functionIds.get(key);
+      if (id === undefined) {
+        id = functions.length + 1;
+        functionIds.set(key, id);
+        functions.push({
+          id,
+          name: remapString(fn.name),
+          systemName: remapString(fn.systemName),
+          filename: remapString(fn.filename),
+          startLine: num(fn.startLine) || undefined,
+        });
+      }
+      functionIdMap.set(num(fn.id), id);
+    }
+
+    const locationIdMap = new Map<number, number>();
+    for (const location of profile.location || []) {
+      const line = (location.line || []).map(l => ({
+        functionId: functionIdMap.get(num(l.functionId)) || 0,
+        line: num(l.line),
+      }));
+      const key =
+        `${num(location.address)}|` +
+        line.map(l => `${l.functionId}:${l.line}`).join(',');
+      let id = locationIds.get(key);
+      if (id === undefined) {
+        id = locations.length + 1;
+        locationIds.set(key, id);
+        locations.push({id, line});
+      }
+      locationIdMap.set(num(location.id), id);
+    }
+
+    const extraLabel =
+      threadLabel === undefined
+        ? undefined
+        : {key: intern(THREAD_LABEL_KEY), str: intern(threadLabel)};
+    for (const sample of profile.sample || []) {
+      const label = (sample.label || []).map(l => ({
+        key: remapString(l.key),
+        str: l.str == null ? undefined : remapString(l.str),
+        num: l.num == null ? undefined : num(l.num),
+        numUnit: l.numUnit == null ? undefined : remapString(l.numUnit),
+      }));
+      if (extraLabel) {
+        label.push(extraLabel);
+      }
+      samples.push({
+        locationId: (sample.locationId || []).map(
+          id => locationIdMap.get(num(id)) || 0
+        ),
+        value: sample.value,
+        label,
+      });
+    }
+  }
+
+  const remapValueType = (
+    valueType: perftools.profiles.IValueType,
+    stringTable: string[]
+  ): perftools.profiles.IValueType => ({
+    type: intern(stringTable[num(valueType.type)] || ''),
+    unit: intern(stringTable[num(valueType.unit)] || ''),
+  });
+  const firstStrings = first.stringTable || [];
+
+  return {
+    sampleType: (first.sampleType || []).map(st =>
+      remapValueType(st, firstStrings)
+    ),
+    sample: samples,
+    location: locations,
+    function: functions,
+    stringTable: strings,
+    timeNanos: first.timeNanos,
+    durationNanos: first.durationNanos,
+    periodType: first.periodType
+      ? remapValueType(first.periodType, firstStrings)
+      : undefined,
+    period: first.period,
+  };
+}
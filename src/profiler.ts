@@ -19,27 +19,84 @@ import {
   ApiError,
   DecorateRequestOptions,
 } from '@google-cloud/common';
+import * as fs from 'fs';
+import * as path from 'path';
 import {heap as heapProfiler, SourceMapper, time as timeProfiler} from 'pprof';
 import * as msToStr from 'pretty-ms';
 import {promisify} from 'util';
-import * as zlib from 'zlib';
 import * as r from 'teeny-request';
 
-import {perftools} from '../protos/profile';
+import type {perftools} from '../protos/profile';
+import {BufferPool, gzipToBase64} from './buffer-pool';
+import {Compressor, createCompressor} from './compression';
 import {ProfilerConfig} from './config';
+import {EncoderPool} from './encoder-pool';
+import {EndpointSelector} from './endpoint-selector';
+import {EventLoopStatsSampler} from './eventloop-stats';
+import {HeapIntervalController} from './heap-controller';
+import {IgnoreMatcher, removeIgnoredSamples} from './ignore-matcher';
 import {createLogger} from './logger';
+import {LoadShedder} from './load-shedder';
+import {AgentMetrics, Metrics} from './metrics';
+import {OverheadController, SAMPLE_COST_MICROS} from './overhead-controller';
+import type {ProfileEncoder} from './profile-encoder';
+import {
+  loadSourceMapperFromCache,
+  saveSourceMapperCache,
+} from './sourcemap-cache';
+import {applySourceMapMemoryCap} from './sourcemap-lru';
 
 import parseDuration from 'parse-duration';
 // eslint-disable-next-line @typescript-eslint/no-var-requires
 const pjson = require('../../package.json');
 const SCOPE = 'https://www.googleapis.com/auth/monitoring.write';
-const gzip = promisify(zlib.gzip);
+
+/**
+ * Resolves with undefined after millis; the timer does not hold the
+ * event loop open.
+ */
+function delayMillis(millis: number): Promise<undefined> {
+  return new Promise<undefined>(resolve => {
+    setTimeout(() => resolve(undefined), millis).unref();
+  });
+}
+
+/**
+ * Loads the generated pprof protobuf module. The generated modules are
+ * large and only needed once a profile is actually serialized, so they are
+ * required on first use rather than at agent require time, keeping them
+ * off the cold-start critical path of --require'd deployments.
+ */
+function requireProfileProto(): typeof import('../protos/profile').perftools {
+  // eslint-disable-next-line @typescript-eslint/no-var-requires
+  return require('../protos/profile').perftools;
+}
+
+/**
+ * Loads the generated profiler service module, needed only on the binary
+ * upload path.
+ */
+function requireProfilerProto(): typeof import('../protos/profiler').google {
+  // eslint-disable-next-line @typescript-eslint/no-var-requires
+  return require('../protos/profiler').google;
+}
+const readdir = promisify(fs.readdir);
+const readFile = promisify(fs.readFile);
+const unlink = promisify(fs.unlink);
 
 enum ProfileTypes {
   Wall = 'WALL',
   Heap = 'HEAP',
 }
 
+enum UploadResult {
+  Success,
+  // Upload failed in a way which may succeed on retry.
+  Retriable,
+  // Upload failed in a way retrying cannot fix.
+  Fatal,
+}
+
 /**
  * @return true iff http status code indicates an error.
  */
@@ -47,6 +104,14 @@ function isErrorResponseStatusCode(code: number) {
   return code < 200 || code >= 300;
 }
 
+/**
+ * @return true iff http status code indicates an error which may succeed
+ * on retry.
+ */
+function isRetriableResponseStatusCode(code: number) {
+  return code === 429 || code >= 500;
+}
+
 /**
  * Interface for deployment field of RequestProfile. Profiles with matching
  * deployments will be grouped together.
@@ -73,7 +138,12 @@ export interface RequestProfile {
   duration?: string;
   profileBytes?: string;
   deployment?: Deployment;
-  labels?: {instance?: string};
+  labels?: {instance?: string; [key: string]: string | undefined};
+
+  // Compressed profile bytes, set in place of the base64 profileBytes field
+  // when the binary upload path is enabled. Never part of a JSON request
+  // body.
+  rawProfileBytes?: Buffer;
 }
 
 /**
@@ -160,6 +230,22 @@ function isDeployment(deployment: any): deployment is Deployment {
   );
 }
 
+/**
+ * Cheap check for the fields of a createProfile response the agent
+ * actually consumes, covering the shape every successful response has.
+ * Runs once per poll fleet-wide, so it avoids the optional-field walk of
+ * the full structural check on the common path.
+ */
+// eslint-disable-next-line @typescript-eslint/no-explicit-any
+function isCommonProfileShape(prof: any): prof is RequestProfile {
+  return (
+    prof &&
+    typeof prof.name === 'string' &&
+    typeof prof.profileType === 'string' &&
+    (prof.duration === undefined || typeof prof.duration === 'string')
+  );
+}
+
 /**
  * @return true if an prof is a RequestProfile and false otherwise.
  */
@@ -178,18 +264,65 @@ function isRequestProfile(prof: any): prof is RequestProfile {
 }
 
 /**
- * Converts a profile to a compressed, base64 encoded string.
- *
- * Work for converting profile is done on the event loop. In particular,
- * profile encoding is done on the event loop. So, this does  block execution
- * of the program, but for a short period of time, since profiles are small.
- *
- * @param p - profile to be converted to string.
+ * Encodes prof as a binary google.devtools.cloudprofiler.v2.Profile
+ * message, used as the body of the upload request on the binary upload
+ * path. The compressed profile bytes are sent raw, with no base64 step.
+ */
+function encodeUploadProfileBody(prof: RequestProfile): Buffer {
+  // eslint-disable-next-line @typescript-eslint/no-explicit-any
+  const profile: any = {
+    name: prof.name,
+    profileType: prof.profileType,
+    profileBytes: prof.rawProfileBytes,
+  };
+  if (prof.labels) {
+    profile.labels = prof.labels;
+  }
+  if (prof.duration) {
+    const durationMillis = parseDuration(prof.duration);
+    if (durationMillis) {
+      profile.duration = {
+        seconds: Math.floor(durationMillis / 1000),
+        nanos: Math.round((durationMillis % 1000) * 1e6),
+      };
+    }
+  }
+  const v2 = requireProfilerProto().devtools.cloudprofiler.v2;
+  const message = v2.Profile.fromObject(profile);
+  return Buffer.from(v2.Profile.encode(message).finish());
+}
+
+/** @return the size, in bytes, of the profile payload carried by prof. */
+function profilePayloadBytes(prof: RequestProfile): number {
+  if (prof.rawProfileBytes) {
+    return prof.rawProfileBytes.length;
+  }
+  return prof.profileBytes ? Buffer.byteLength(prof.profileBytes) : 0;
+}
+
+/**
+ * Encodes p in small batches fed into a streaming compressor, yielding to
+ * the event loop between batches. Used on the main-thread encode path when
+ * streamingEncode is set, so serialization of a large profile is spread
+ * over many short turns instead of one synchronous burst at the end of
+ * the profiled window.
  */
-async function profileBytes(p: perftools.profiles.IProfile): Promise<string> {
-  const buffer = perftools.profiles.Profile.encode(p).finish();
-  const gzBuf = (await gzip(buffer)) as Buffer;
-  return gzBuf.toString('base64');
+async function encodeAndCompressStreaming(
+  p: perftools.profiles.IProfile,
+  stream: NodeJS.ReadWriteStream
+): Promise<Buffer> {
+  // eslint-disable-next-line @typescript-eslint/no-var-requires
+  const {encodeProfileChunked} = require('./profile-encoder');
+  const out: Buffer[] = [];
+  stream.on('data', (chunk: Buffer) => out.push(chunk));
+  const done = new Promise<void>((resolve, reject) => {
+    stream.on('end', resolve);
+    stream.on('error', reject);
+  });
+  await encodeProfileChunked(p, (batch: Buffer) => stream.write(batch));
+  stream.end();
+  await done;
+  return Buffer.concat(out);
 }
 
 /**
@@ -266,7 +399,7 @@ function responseToProfileOrError(
   if (err) {
     throw err;
   }
-  if (isRequestProfile(body)) {
+  if (isCommonProfileShape(body) || isRequestProfile(body)) {
     return body;
   }
   throw new Error(`Profile not valid: ${JSON.stringify(body)}.`);
@@ -284,9 +417,72 @@ export class Profiler extends ServiceObject {
   private profileLabels: {instance?: string};
   private deployment: Deployment;
   private profileTypes: string[];
+
+  // Body sent with every createProfile poll. Its fields never change
+  // after construction (the deferMetadata path rebuilds it once the
+  // metadata-derived fields resolve), so it is assembled once and reused
+  // rather than rebuilt for each of the fleet's once-a-minute polls.
+  private createProfileBody: {deployment: Deployment; profileType: string[]};
   private retryer: Retryer;
   private sourceMapper: SourceMapper | undefined;
-  private baseApiUrl: string;
+  private encoderPool: EncoderPool | undefined;
+  private pendingUploads: Set<Promise<void>> = new Set();
+
+  // Bounded queue of profiles whose upload failed with a retriable error,
+  // drained in a batch once uploads succeed again or after a backoff.
+  private uploadQueue: RequestProfile[] = [];
+  private uploadRetryer: Retryer;
+  private uploadQueueTimer: NodeJS.Timeout | undefined;
+  // Set while a drain pass is running; concurrent drain requests join it.
+  private uploadQueueDrain: Promise<void> | undefined;
+  private spillCounter = 0;
+  private overheadController: OverheadController | undefined;
+  private heapIntervalController: HeapIntervalController | undefined;
+  // Compiled from ignoreHeapSamplesPaths; undefined when none configured.
+  private ignoreMatcher: IgnoreMatcher | undefined;
+
+  // Samples event loop lag and utilization over each time profiling
+  // window; undefined unless collectEventLoopStats is set.
+  private eventLoopStats: EventLoopStatsSampler | undefined;
+
+  // Self-telemetry; exposed through getMetrics() and metricsCallback.
+  private metrics: AgentMetrics = new AgentMetrics();
+
+  // Prioritized API endpoints with health tracking; requests go to the
+  // first healthy endpoint and fail over to the next.
+  private endpoints: EndpointSelector;
+  private loadShedder: LoadShedder | undefined;
+
+  // Set by stop(); the run loop halts and in-flight polls are cancelled.
+  private stopped = false;
+  private runTimer: NodeJS.Timeout | undefined;
+  private cancelCreateProfile: (() => void) | undefined;
+
+  // Resolves once fields derived from the metadata service are final; polls
+  // to the profiler server wait on this. Already resolved except on the
+  // deferMetadata start path.
+  private metadataReady: Promise<void> = Promise.resolve();
+
+  // Incremental encoder for heap profiles on the main-thread encode path;
+  // the worker keeps its own. Heap profiles of a steady-state service are
+  // dominated by table entries identical between consecutive profiles.
+  // Constructed on first heap profile serialization so the encoder (and
+  // the generated proto module it pulls in) stay off the require path.
+  private heapProfileEncoder: ProfileEncoder | undefined;
+
+  // Reusable output buffer for compression on the main-thread encode path.
+  private bufferPool: BufferPool = new BufferPool();
+
+  // Codec profile payloads are compressed with; gzip at the default level
+  // unless configured otherwise.
+  private compressor: Compressor;
+
+  // When set, collection is delegated here instead of using the local
+  // pprof profilers; used by cluster coordinator mode, where profiles are
+  // collected in worker processes and arrive already serialized.
+  collectDelegate:
+    | ((prof: RequestProfile) => Promise<RequestProfile>)
+    | undefined;
 
   // Public for testing.
   config: ProfilerConfig;
@@ -305,10 +501,98 @@ export class Profiler extends ServiceObject {
       baseUrl: '/',
     });
     this.config = config;
-    this.baseApiUrl = baseApiUrl;
+    this.endpoints = new EndpointSelector(
+      config.apiEndpoints && config.apiEndpoints.length > 0
+        ? config.apiEndpoints
+        : [config.apiEndpoint]
+    );
+
+    this.logger = createLogger(this.config.logLevel, this.config.asyncLogging);
+
+    this.compressor = createCompressor(
+      this.config.compressionCodec,
+      this.config.compressionLevel
+    );
+    if (
+      this.config.compressionCodec &&
+      this.compressor.codec !== this.config.compressionCodec
+    ) {
+      this.logger.warn(
+        `Compression codec ${this.config.compressionCodec} is not available` +
+          ` in this Node version; using gzip.`
+      );
+    }
+
+    this.deployment = this.buildDeployment();
+    this.profileLabels = this.buildProfileLabels();
+
+    this.profileTypes = [];
+    if (!this.config.disableTime) {
+      this.profileTypes.push(ProfileTypes.Wall);
+    }
+    if (!this.config.disableHeap) {
+      this.profileTypes.push(ProfileTypes.Heap);
+    }
+    this.createProfileBody = Object.freeze({
+      deployment: this.deployment,
+      profileType: this.profileTypes,
+    });
+    this.retryer = new Retryer(
+      this.config.initialBackoffMillis,
+      this.config.backoffCapMillis,
+      this.config.backoffMultiplier
+    );
+    this.uploadRetryer = new Retryer(
+      this.config.initialBackoffMillis,
+      this.config.backoffCapMillis,
+      this.config.backoffMultiplier
+    );
+
+    if (!this.config.disableEncodeWorker) {
+      // The worker gets the codec actually chosen, so an unavailable codec
+      // is substituted (and warned about) once, here.
+      this.encoderPool = new EncoderPool(
+        this.compressor.codec,
+        this.config.compressionLevel
+      );
+    }
+
+    if (this.config.maxOverheadPercent !== undefined) {
+      this.overheadController = new OverheadController(
+        this.config.timeIntervalMicros,
+        this.config.maxOverheadPercent
+      );
+    }
+
+    if (this.config.maxEventLoopLagMillis !== undefined) {
+      this.loadShedder = new LoadShedder(this.config.maxEventLoopLagMillis);
+    }
+
+    if (this.config.collectEventLoopStats) {
+      this.eventLoopStats = new EventLoopStatsSampler();
+    }
 
-    this.logger = createLogger(this.config.logLevel);
+    if (
+      this.config.ignoreHeapSamplesPaths &&
+      this.config.ignoreHeapSamplesPaths.length > 0
+    ) {
+      this.ignoreMatcher = new IgnoreMatcher(
+        this.config.ignoreHeapSamplesPaths
+      );
+    }
 
+    if (
+      this.config.heapTargetSampleCount !== undefined &&
+      !this.config.disableHeap
+    ) {
+      this.heapIntervalController = new HeapIntervalController(
+        this.config.heapIntervalBytes,
+        this.config.heapTargetSampleCount
+      );
+    }
+  }
+
+  private buildDeployment(): Deployment {
     const labels: {zone?: string; version?: string; language: string} = {
       language: 'nodejs',
     };
@@ -318,29 +602,46 @@ export class Profiler extends ServiceObject {
     if (this.config.serviceContext.version) {
       labels.version = this.config.serviceContext.version;
     }
-    this.deployment = {
+    return {
       projectId: this.config.projectId,
       target: this.config.serviceContext.service,
       labels,
     };
+  }
 
-    this.profileLabels = {};
+  private buildProfileLabels(): {instance?: string} {
+    const profileLabels: {instance?: string} = {};
     if (this.config.instance) {
-      this.profileLabels.instance = this.config.instance;
+      profileLabels.instance = this.config.instance;
     }
+    return profileLabels;
+  }
 
-    this.profileTypes = [];
-    if (!this.config.disableTime) {
-      this.profileTypes.push(ProfileTypes.Wall);
-    }
-    if (!this.config.disableHeap) {
-      this.profileTypes.push(ProfileTypes.Heap);
-    }
-    this.retryer = new Retryer(
-      this.config.initialBackoffMillis,
-      this.config.backoffCapMillis,
-      this.config.backoffMultiplier
-    );
+  /**
+   * Completes configuration of a profiler constructed before the metadata
+   * service was consulted (the deferMetadata start path). The deployment
+   * and profile labels are rebuilt once configPromise resolves; polls to
+   * the profiler server wait for that. If configPromise rejects, the
+   * profiler is stopped with an error log, matching the failure the
+   * blocking start path reports by rejecting.
+   */
+  setConfigMetadata(configPromise: Promise<ProfilerConfig>): void {
+    this.metadataReady = configPromise
+      .then((config: ProfilerConfig) => {
+        this.config = config;
+        this.deployment = this.buildDeployment();
+        this.profileLabels = this.buildProfileLabels();
+        this.createProfileBody = Object.freeze({
+          deployment: this.deployment,
+          profileType: this.profileTypes,
+        });
+      })
+      .catch((err: Error) => {
+        this.logger.error(
+          `Failed to initialize config, profiler stopped: ${err}`
+        );
+        this.stop();
+      });
   }
 
   /**
@@ -354,29 +655,134 @@ export class Profiler extends ServiceObject {
    * error level and getting profile type will be retried.
    */
   async start(): Promise<void> {
-    if (!this.config.disableSourceMaps) {
+    this.stopped = false;
+    if (!this.config.disableSourceMaps && !this.sourceMapper) {
+      const created = this.createSourceMapper()
+        .then((sourceMapper: SourceMapper) => {
+          this.sourceMapper = sourceMapper;
+        })
+        .catch((err: Error) => {
+          this.logger.error(
+            `Failed to initialize SourceMapper. Source map support has been disabled: ${err}`
+          );
+          this.config.disableSourceMaps = true;
+        });
+      // With deferSourceMaps, indexing continues in the background and
+      // profiles collected before it completes are not re-mapped.
+      if (!this.config.deferSourceMaps) {
+        await created;
+      }
+    }
+    this.logger.debug(`Cloud Profiler Node.js agent version: ${pjson.version}`);
+    this.runLoop();
+  }
+
+  /**
+   * Creates the source mapper, restoring it from the on-disk index when
+   * sourceMapCachePath is set and the index is still valid, and persisting
+   * a fresh index after a full scan. Caching is best-effort; failures are
+   * logged and the full scan result is used.
+   */
+  private async createSourceMapper(): Promise<SourceMapper> {
+    const cachePath = this.config.sourceMapCachePath;
+    if (cachePath) {
       try {
-        this.sourceMapper = await SourceMapper.create(
+        const cached = await loadSourceMapperFromCache(
+          cachePath,
           this.config.sourceMapSearchPath
         );
+        if (cached) {
+          this.logger.debug(`Loaded source map index from ${cachePath}.`);
+          return this.applySourceMapCap(cached);
+        }
       } catch (err) {
-        this.logger.error(
-          `Failed to initialize SourceMapper. Source map support has been disabled: ${err}`
+        this.logger.debug(`Could not load source map index: ${err}`);
+      }
+    }
+    const sourceMapper = await SourceMapper.create(
+      this.config.sourceMapSearchPath
+    );
+    if (cachePath) {
+      try {
+        await saveSourceMapperCache(
+          cachePath,
+          this.config.sourceMapSearchPath,
+          sourceMapper
         );
-        this.config.disableSourceMaps = true;
+      } catch (err) {
+        this.logger.debug(`Could not save source map index: ${err}`);
       }
     }
-    this.logger.debug(`Cloud Profiler Node.js agent version: ${pjson.version}`);
-    this.runLoop();
+    return this.applySourceMapCap(sourceMapper);
+  }
+
+  /**
+   * Applies sourceMapCacheMaxBytes to mapper, when configured. Best
+   * effort: when the cap cannot be applied the unbounded mapper is used
+   * and a message logged.
+   */
+  private applySourceMapCap(sourceMapper: SourceMapper): SourceMapper {
+    const maxBytes = this.config.sourceMapCacheMaxBytes;
+    if (maxBytes === undefined) {
+      return sourceMapper;
+    }
+    try {
+      if (!applySourceMapMemoryCap(sourceMapper, maxBytes)) {
+        this.logger.warn(
+          'Could not bound source map memory: unexpected source mapper format.'
+        );
+      }
+    } catch (err) {
+      this.logger.warn(`Could not bound source map memory: ${err}`);
+    }
+    return sourceMapper;
   }
 
   /**
    * Endlessly polls the profiler server for instructions, and collects and
-   * uploads profiles as requested.
+   * uploads profiles as requested, until stop() is called.
    */
   async runLoop() {
+    if (this.stopped) {
+      return;
+    }
     const delayMillis = await this.collectProfile();
-    setTimeout(this.runLoop.bind(this), delayMillis).unref();
+    if (this.stopped) {
+      return;
+    }
+    this.runTimer = setTimeout(this.runLoop.bind(this), delayMillis);
+    this.runTimer.unref();
+  }
+
+  /**
+   * Stops the profiler: the in-flight poll to the profiler server is
+   * cancelled, the run loop halts, and the encode worker is terminated, so
+   * an idle process is no longer kept alive by profiling work. Queued
+   * upload retries are dropped. Profiling can be re-armed by calling
+   * start() again.
+   *
+   * The transport offers no handle on the underlying socket, so a poll the
+   * server is still hanging on is abandoned rather than aborted; its
+   * connection closes when the server responds or the request times out.
+   */
+  stop(): void {
+    this.stopped = true;
+    if (this.runTimer) {
+      clearTimeout(this.runTimer);
+      this.runTimer = undefined;
+    }
+    if (this.uploadQueueTimer) {
+      clearTimeout(this.uploadQueueTimer);
+      this.uploadQueueTimer = undefined;
+    }
+    this.uploadQueue = [];
+    if (this.cancelCreateProfile) {
+      this.cancelCreateProfile();
+      this.cancelCreateProfile = undefined;
+    }
+    if (this.encoderPool) {
+      this.encoderPool.stop();
+    }
   }
 
   /**
@@ -391,6 +797,11 @@ export class Profiler extends ServiceObject {
     try {
       prof = await this.createProfile();
     } catch (err) {
+      if (this.stopped) {
+        this.logger.debug(`Profile creation cancelled: profiler stopped.`);
+        return 0;
+      }
+      this.metrics.createProfileBackoffs++;
       if (isBackoffResponseError(err)) {
         this.logger.debug(
           `Must wait ${msToStr(err.backoffMillis)} to create profile: ${err}`
@@ -406,10 +817,36 @@ export class Profiler extends ServiceObject {
       return backoff;
     }
     this.retryer.reset();
-    await this.profileAndUpload(prof);
+    await this.scheduleUpload(prof);
     return 0;
   }
 
+  /**
+   * Collects prof, then starts its upload without waiting for completion,
+   * so the next poll to the profiler server is issued concurrently with
+   * the upload of the profile just collected. Collection itself is always
+   * awaited: the pprof wall profiler is a process-wide singleton and
+   * cannot run two overlapping windows, so the next server assignment
+   * must not begin collecting before the current window closes. The
+   * number of in-flight uploads is bounded by maxPendingUploads; once the
+   * bound is reached this waits for an upload to settle before resolving.
+   * With maxPendingUploads set to 1, collection and upload complete
+   * before the next poll is made.
+   */
+  private async scheduleUpload(prof: RequestProfile): Promise<void> {
+    const collected = await this.collectForUpload(prof);
+    if (collected === undefined) {
+      return;
+    }
+    const upload: Promise<void> = this.uploadCollected(collected).then(() => {
+      this.pendingUploads.delete(upload);
+    });
+    this.pendingUploads.add(upload);
+    if (this.pendingUploads.size >= this.config.maxPendingUploads) {
+      await Promise.race(this.pendingUploads);
+    }
+  }
+
   /**
    * Talks to profiler server, which hangs until server indicates
    * job should be profiled and then indicates what type of profile should
@@ -429,17 +866,55 @@ export class Profiler extends ServiceObject {
    * Public to allow for testing.
    */
   async createProfile(): Promise<RequestProfile> {
-    const reqBody = {
-      deployment: this.deployment,
-      profileType: this.profileTypes,
-    };
+    await this.metadataReady;
+    if (this.stopped) {
+      throw new Error('Profiler stopped.');
+    }
+    const endpoint = this.endpoints.primary();
+    try {
+      const prof = await this.createProfileRequest(endpoint);
+      this.endpoints.markSuccess(endpoint);
+      return prof;
+    } catch (err) {
+      // A server-specified backoff means the endpoint is healthy; a
+      // request cancelled by stop() says nothing about it.
+      if (this.stopped || isBackoffResponseError(err)) {
+        throw err;
+      }
+      this.endpoints.markFailure(endpoint);
+      const fallback = this.endpoints.fallback(endpoint);
+      if (fallback === undefined) {
+        throw err;
+      }
+      this.logger.debug(
+        `Retrying profile creation against ${fallback}: ${err}`
+      );
+      try {
+        const prof = await this.createProfileRequest(fallback);
+        this.endpoints.markSuccess(fallback);
+        return prof;
+      } catch (fallbackErr) {
+        if (!this.stopped && !isBackoffResponseError(fallbackErr)) {
+          this.endpoints.markFailure(fallback);
+        }
+        throw fallbackErr;
+      }
+    }
+  }
+
+  /** Issues one createProfile long-poll against the given endpoint. */
+  private createProfileRequest(endpoint: string): Promise<RequestProfile> {
     const options: DecorateRequestOptions = {
       method: 'POST',
-      uri: '/profiles',
-      body: reqBody,
+      uri: `https://${endpoint}/v2/projects/${this.config.projectId}/profiles`,
+      body: this.createProfileBody,
       json: true,
       maxRetries: 0,
 
+      // Reuse one keep-alive connection across consecutive polls and
+      // uploads, rather than paying a TLS handshake per request.
+      forever: this.config.keepAlive,
+
       // Default timeout for for a request is 1 minute, but request to create
       // profile is designed to hang until it is time to collect a profile
       // (up to one hour).
@@ -448,6 +923,12 @@ export class Profiler extends ServiceObject {
 
     this.logger.debug('Attempting to create profile.');
     return new Promise<RequestProfile>((resolve, reject) => {
+      // Allows stop() to settle this promise while the request is hanging,
+      // so the run loop is not pinned to an hour-long poll.
+      const cancel = () => {
+        reject(new Error('Profiler stopped.'));
+      };
+      this.cancelCreateProfile = cancel;
       this.request(
         options,
         (
@@ -456,6 +937,11 @@ export class Profiler extends ServiceObject {
           // eslint-disable-next-line @typescript-eslint/no-explicit-any
           response?: r.Response<any>
         ) => {
+          // An abandoned poll's callback can arrive long after stop(); only
+          // clear the canceller if it is still this request's own.
+          if (this.cancelCreateProfile === cancel) {
+            this.cancelCreateProfile = undefined;
+          }
           try {
             const prof = responseToProfileOrError(err, body, response);
             this.logger.debug(
@@ -478,36 +964,324 @@ export class Profiler extends ServiceObject {
    * Public to allow for testing.
    */
   async profileAndUpload(prof: RequestProfile): Promise<void> {
+    const collected = await this.collectForUpload(prof);
+    if (collected !== undefined) {
+      await this.uploadCollected(collected);
+    }
+  }
+
+  /**
+   * Collects prof, unless the load shedder defers it, and returns it
+   * ready for upload. Collection problems are logged and reflected in the
+   * metrics, and undefined returned.
+   */
+  private async collectForUpload(
+    prof: RequestProfile
+  ): Promise<RequestProfile | undefined> {
+    if (this.loadShedder && this.loadShedder.shouldShed()) {
+      this.logger.warn(
+        `Deferring profile ${prof.profileType}: event loop lag exceeds` +
+          ` ${this.config.maxEventLoopLagMillis}ms.`
+      );
+      return undefined;
+    }
+    const collectStartMillis = Date.now();
     try {
       this.logger.debug(`Starting collection of profile ${prof.profileType}.`);
       prof = await this.profile(prof);
       this.logger.debug(`Successfully collected profile ${prof.profileType}.`);
-      prof.labels = this.profileLabels;
+      // Keep labels collection attached (event loop stats) alongside the
+      // deployment-derived ones.
+      prof.labels = prof.labels
+        ? {...this.profileLabels, ...prof.labels}
+        : this.profileLabels;
     } catch (err) {
       this.logger.debug(`Failed to collect profile: ${err}`);
+      this.metrics.collectionErrors++;
+      this.reportMetrics();
+      return undefined;
+    }
+    this.metrics.profilesCollected++;
+    this.metrics.collect.record(Date.now() - collectStartMillis);
+    return prof;
+  }
+
+  /**
+   * Uploads a collected profile, queueing it for retry when the upload
+   * fails with a retriable error.
+   */
+  private async uploadCollected(prof: RequestProfile): Promise<void> {
+    const result = await this.uploadProfile(prof);
+    if (result === UploadResult.Success) {
+      this.uploadRetryer.reset();
+      await this.drainUploadQueue();
+    } else if (result === UploadResult.Retriable) {
+      this.enqueueFailedUpload(prof);
+    }
+    this.reportMetrics();
+  }
+
+  /**
+   * @return a snapshot of the agent's self-telemetry: counters and timing
+   * distributions for collection, serialization and upload. Counters are
+   * cumulative since the profiler was constructed.
+   */
+  getMetrics(): Metrics {
+    return this.metrics.snapshot();
+  }
+
+  /** Invokes the metricsCallback config hook, if one is set. */
+  private reportMetrics(): void {
+    if (!this.config.metricsCallback) {
       return;
     }
-    const options = {
-      method: 'PATCH',
-      uri: this.baseApiUrl + '/' + prof.name,
-      body: prof,
-      json: true,
-      maxRetries: 0,
-    };
+    try {
+      this.config.metricsCallback(this.metrics.snapshot());
+    } catch (err) {
+      this.logger.debug(`Metrics callback threw: ${err}`);
+    }
+  }
 
+  /**
+   * Uploads prof, which must already hold its profile bytes, to the
+   * profiler API. The upload goes to the first healthy endpoint; when
+   * hedgeUploadLatencyMillis is set and the upload exceeds it, a second
+   * attempt is raced against the next endpoint and the first success
+   * wins, bounding tail latency while an endpoint is degraded.
+   */
+  private async uploadProfile(prof: RequestProfile): Promise<UploadResult> {
+    const result = await this.uploadProfileHedged(prof);
+    // Both hedged attempts can succeed; the profile still uploaded once.
+    if (result === UploadResult.Success) {
+      this.metrics.profilesUploaded++;
+      this.metrics.uploadedBytes += profilePayloadBytes(prof);
+    }
+    return result;
+  }
+
+  private async uploadProfileHedged(
+    prof: RequestProfile
+  ): Promise<UploadResult> {
+    const endpoint = this.endpoints.primary();
+    const primaryAttempt = this.uploadProfileTo(endpoint, prof);
+    const hedgeMillis = this.config.hedgeUploadLatencyMillis;
+    if (hedgeMillis === undefined) {
+      return primaryAttempt;
+    }
+    const winner = await Promise.race([
+      primaryAttempt,
+      delayMillis(hedgeMillis),
+    ]);
+    if (winner !== undefined) {
+      return winner;
+    }
+    const fallback = this.endpoints.fallback(endpoint);
+    if (fallback === undefined) {
+      return primaryAttempt;
+    }
+    this.logger.debug(
+      `Upload to ${endpoint} exceeded ${hedgeMillis}ms;` +
+        ` hedging against ${fallback}.`
+    );
+    const fallbackAttempt = this.uploadProfileTo(fallback, prof);
+    return new Promise<UploadResult>(resolve => {
+      let settledCount = 0;
+      const onResult = (result: UploadResult) => {
+        settledCount++;
+        if (result === UploadResult.Success || settledCount === 2) {
+          resolve(result);
+        }
+      };
+      primaryAttempt.then(onResult);
+      fallbackAttempt.then(onResult);
+    });
+  }
+
+  /** Issues one upload request for prof against the given endpoint. */
+  private async uploadProfileTo(
+    endpoint: string,
+    prof: RequestProfile
+  ): Promise<UploadResult> {
+    const uri = `https://${endpoint}/v2/` + prof.name;
+    const options =
+      this.config.binaryUpload && prof.rawProfileBytes
+        ? {
+            method: 'PATCH',
+            uri,
+            body: encodeUploadProfileBody(prof),
+            headers: {'Content-Type': 'application/x-protobuf'},
+            maxRetries: 0,
+            forever: this.config.keepAlive,
+          }
+        : {
+            method: 'PATCH',
+            uri,
+            body: prof,
+            json: true,
+            maxRetries: 0,
+            forever: this.config.keepAlive,
+          };
+
+    const uploadStartMillis = Date.now();
     try {
       const [, res] = await this.request(options);
+      this.metrics.upload.record(Date.now() - uploadStartMillis);
       if (isErrorResponseStatusCode(res.statusCode)) {
         let message: number | string = res.statusCode;
         if (res.statusMessage) {
           message = res.statusMessage;
         }
         this.logger.debug(`Could not upload profile: ${message}.`);
-        return;
+        this.metrics.uploadErrors++;
+        if (isRetriableResponseStatusCode(res.statusCode)) {
+          this.endpoints.markFailure(endpoint);
+          return UploadResult.Retriable;
+        }
+        // A non-retriable response still means the endpoint answered.
+        this.endpoints.markSuccess(endpoint);
+        return UploadResult.Fatal;
       }
       this.logger.debug(`Successfully uploaded profile ${prof.profileType}.`);
+      this.endpoints.markSuccess(endpoint);
+      return UploadResult.Success;
     } catch (err) {
+      this.metrics.upload.record(Date.now() - uploadStartMillis);
+      this.metrics.uploadErrors++;
+      this.endpoints.markFailure(endpoint);
       this.logger.debug(`Failed to upload profile: ${err}`);
+      return UploadResult.Retriable;
+    }
+  }
+
+  /**
+   * Queues prof for a later upload attempt. Collection is the expensive
+   * part of a cycle, so profiles whose upload failed with a retriable error
+   * are kept (bounded by uploadRetryQueueSize) rather than dropped. When
+   * the queue is full the oldest profile is spilled to uploadRetryQueueDir,
+   * or dropped if no spill directory is configured.
+   */
+  private enqueueFailedUpload(prof: RequestProfile): void {
+    if (this.config.uploadRetryQueueSize <= 0) {
+      return;
+    }
+    this.uploadQueue.push(prof);
+    this.metrics.uploadsRetried++;
+    if (this.uploadQueue.length > this.config.uploadRetryQueueSize) {
+      const evicted = this.uploadQueue.shift()!;
+      if (this.config.uploadRetryQueueDir) {
+        this.spillProfile(evicted);
+      } else {
+        this.logger.debug(
+          `Dropping profile ${evicted.profileType}: upload retry queue is full.`
+        );
+      }
+    }
+    this.scheduleUploadQueueDrain();
+  }
+
+  private scheduleUploadQueueDrain(): void {
+    if (this.uploadQueueTimer) {
+      return;
+    }
+    const backoff = this.uploadRetryer.getBackoff();
+    this.logger.debug(
+      `Waiting ${msToStr(backoff)} to retry queued profile uploads.`
+    );
+    this.uploadQueueTimer = setTimeout(() => {
+      this.uploadQueueTimer = undefined;
+      this.drainUploadQueue();
+    }, backoff);
+    this.uploadQueueTimer.unref();
+  }
+
+  /**
+   * Attempts to upload queued profiles in a batch, oldest first. Stops and
+   * re-arms the retry backoff on the first retriable failure; profiles
+   * whose upload fails with an error retrying cannot fix (for example the
+   * profile has expired server-side) are dropped.
+   */
+  private drainUploadQueue(): Promise<void> {
+    // Pipelined uploads and the backoff timer can all request a drain;
+    // concurrent passes would upload the head profile twice and shift
+    // un-uploaded profiles off the queue, so a pass already in progress
+    // is shared instead.
+    if (!this.uploadQueueDrain) {
+      const done = () => {
+        this.uploadQueueDrain = undefined;
+      };
+      this.uploadQueueDrain = this.drainUploadQueueOnce().then(done, done);
+    }
+    return this.uploadQueueDrain;
+  }
+
+  private async drainUploadQueueOnce(): Promise<void> {
+    if (this.uploadQueueTimer) {
+      clearTimeout(this.uploadQueueTimer);
+      this.uploadQueueTimer = undefined;
+    }
+    while (this.uploadQueue.length > 0) {
+      const result = await this.uploadProfile(this.uploadQueue[0]);
+      if (result === UploadResult.Retriable) {
+        this.scheduleUploadQueueDrain();
+        return;
+      }
+      this.uploadQueue.shift();
+    }
+    this.uploadRetryer.reset();
+    await this.drainSpilledProfiles();
+  }
+
+  /**
+   * Writes prof to the spill directory; spilled profiles are re-uploaded
+   * once the in-memory retry queue drains. Best-effort: write failures are
+   * logged and the profile dropped.
+   */
+  private spillProfile(prof: RequestProfile): void {
+    const file = path.join(
+      this.config.uploadRetryQueueDir!,
+      `profile-${Date.now()}-${this.spillCounter++}.json`
+    );
+    fs.writeFile(file, JSON.stringify(prof), err => {
+      if (err) {
+        this.logger.debug(`Failed to spill profile: ${err}`);
+      }
+    });
+  }
+
+  private async drainSpilledProfiles(): Promise<void> {
+    const dir = this.config.uploadRetryQueueDir;
+    if (!dir) {
+      return;
+    }
+    let files: string[];
+    try {
+      files = (await readdir(dir)).filter(f => f.startsWith('profile-')).sort();
+    } catch (err) {
+      return;
+    }
+    for (const f of files) {
+      const file = path.join(dir, f);
+      let prof: RequestProfile;
+      try {
+        prof = JSON.parse((await readFile(file)).toString());
+        if (prof.rawProfileBytes) {
+          // The JSON round-trip turns Buffers into {type, data} objects.
+          prof.rawProfileBytes = Buffer.from(
+            // eslint-disable-next-line @typescript-eslint/no-explicit-any
+            (prof.rawProfileBytes as any).data
+          );
+        }
+      } catch (err) {
+        this.logger.debug(`Could not read spilled profile ${file}: ${err}`);
+        await unlink(file).catch(() => {});
+        continue;
+      }
+      const result = await this.uploadProfile(prof);
+      if (result === UploadResult.Retriable) {
+        this.scheduleUploadQueueDrain();
+        return;
+      }
+      await unlink(file).catch(() => {});
     }
   }
 
@@ -520,6 +1294,9 @@ export class Profiler extends ServiceObject {
    * Public to allow for testing.
    */
   async profile(prof: RequestProfile): Promise<RequestProfile> {
+    if (this.collectDelegate) {
+      return this.collectDelegate(prof);
+    }
     switch (prof.profileType) {
       case ProfileTypes.Wall:
         this.logger.debug(
@@ -555,15 +1332,49 @@ export class Profiler extends ServiceObject {
     }
     const options = {
       durationMillis,
-      intervalMicros: this.config.timeIntervalMicros,
+      intervalMicros: this.overheadController
+        ? this.overheadController.currentIntervalMicros()
+        : this.config.timeIntervalMicros,
       sourceMapper: this.sourceMapper,
     };
 
+    if (this.eventLoopStats) {
+      this.eventLoopStats.start();
+    }
     const p = await timeProfiler.profile(options);
-    prof.profileBytes = await profileBytes(p);
+    if (this.eventLoopStats) {
+      // Attached to the profile in profileAndUpload, merged with the
+      // deployment-derived labels.
+      prof.labels = this.eventLoopStats.stop();
+    }
+    const encodeMillis = await this.serializeProfile(prof, p);
+    if (this.overheadController) {
+      const sampleCount = p.sample ? p.sample.length : 0;
+      // Only time the event loop actually paid for counts against the
+      // budget; with the encode worker, encodeMillis is 0.
+      const overheadMicros =
+        sampleCount * SAMPLE_COST_MICROS + encodeMillis * 1000;
+      this.overheadController.record(overheadMicros, durationMillis * 1000);
+    }
     return prof;
   }
 
+  /**
+   * Restarts the heap sampler with a new average sampling interval, in
+   * bytes. The change takes effect immediately, but samples accumulated
+   * under the old interval are discarded, so this is best called right
+   * after a heap profile has been collected. No-op when heap profiling is
+   * disabled.
+   */
+  setHeapSamplingInterval(intervalBytes: number): void {
+    if (this.config.disableHeap) {
+      return;
+    }
+    heapProfiler.stop();
+    heapProfiler.start(intervalBytes, this.config.heapMaxStackDepth);
+    this.config.heapIntervalBytes = intervalBytes;
+  }
+
   /**
    * Collects a heap profile, converts profile to compressed, base64 encoded
    * string, and adds profileBytes field to prof with this string.
@@ -578,7 +1389,105 @@ export class Profiler extends ServiceObject {
       this.config.ignoreHeapSamplesPath,
       this.sourceMapper
     );
-    prof.profileBytes = await profileBytes(p);
+    if (this.ignoreMatcher) {
+      removeIgnoredSamples(p, this.ignoreMatcher);
+    }
+    if (this.heapIntervalController) {
+      const sampleCount = p.sample ? p.sample.length : 0;
+      const intervalBytes = this.heapIntervalController.record(sampleCount);
+      if (intervalBytes !== undefined) {
+        this.logger.debug(
+          `Retuning heap sampling interval to ${intervalBytes} bytes` +
+            ` after observing ${sampleCount} samples.`
+        );
+        this.setHeapSamplingInterval(intervalBytes);
+      }
+    }
+    if (!this.heapProfileEncoder) {
+      // eslint-disable-next-line @typescript-eslint/no-var-requires
+      const {ProfileEncoder} = require('./profile-encoder');
+      this.heapProfileEncoder = new ProfileEncoder();
+    }
+    await this.serializeProfile(
+      prof,
+      p,
+      ProfileTypes.Heap,
+      this.heapProfileEncoder
+    );
     return prof;
   }
+
+  /**
+   * Serializes and compresses p and attaches the result to prof: raw bytes
+   * when the binary upload path is enabled, base64-encoded for the JSON
+   * upload path otherwise.
+   *
+   * Encoding happens on the worker thread when the encoder pool is
+   * available. On the main-thread fallback, the compressed output is assembled
+   * into a pooled buffer sized to the high-water mark of recent profiles,
+   * so steady-state serialization performs no new large allocations beyond
+   * the base64 string the JSON upload path requires.
+   *
+   * When a cacheKey and encoder are given, encoding is incremental: table
+   * entries unchanged since the previous profile with the same key reuse
+   * their already-serialized bytes.
+   *
+   * @return the time, in ms, spent encoding on the main thread, for the
+   * overhead budget; 0 when the worker thread did the work.
+   */
+  private async serializeProfile(
+    prof: RequestProfile,
+    p: perftools.profiles.IProfile,
+    cacheKey?: string,
+    encoder?: ProfileEncoder
+  ): Promise<number> {
+    const serializeStartMillis = Date.now();
+    if (this.encoderPool) {
+      try {
+        const gzBuf = await this.encoderPool.encode(p, cacheKey);
+        if (this.config.binaryUpload) {
+          prof.rawProfileBytes = gzBuf;
+        } else {
+          prof.profileBytes = gzBuf.toString('base64');
+        }
+        this.metrics.serialize.record(Date.now() - serializeStartMillis);
+        return 0;
+      } catch (err) {
+        // Fall through to encoding on the main thread.
+      }
+    }
+    // Main-thread time is measured from here, so a failed worker attempt
+    // above is not charged to the event loop.
+    const mainThreadStartMillis = Date.now();
+    // The streaming path trades the incremental encoder's caching for
+    // spreading the cost over event loop turns; profiles with an
+    // incremental encoder (heap) are cheap to re-encode already.
+    if (this.config.streamingEncode && !encoder) {
+      const gzBuf = await encodeAndCompressStreaming(
+        p,
+        this.compressor.createStream()
+      );
+      if (this.config.binaryUpload) {
+        prof.rawProfileBytes = gzBuf;
+      } else {
+        prof.profileBytes = gzBuf.toString('base64');
+      }
+      this.metrics.serialize.record(Date.now() - serializeStartMillis);
+      return Date.now() - mainThreadStartMillis;
+    }
+    const buffer = encoder
+      ? encoder.encode(p)
+      : requireProfileProto().profiles.Profile.encode(p).finish();
+    if (this.config.binaryUpload) {
+      prof.rawProfileBytes = await this.compressor.compress(buffer);
+    } else {
+      prof.profileBytes = await gzipToBase64(
+        buffer,
+        this.bufferPool,
+        this.compressor.createStream()
+      );
+    }
+    this.metrics.serialize.record(Date.now() - serializeStartMillis);
+    return Date.now() - mainThreadStartMillis;
+  }
 }
@@ -0,0 +1,135 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as fs from 'fs';
+import {SourceMapper} from 'pprof';
+import {promisify} from 'util';
+
+const readFile = promisify(fs.readFile);
+const writeFile = promisify(fs.writeFile);
+const rename = promisify(fs.rename);
+const stat = promisify(fs.stat);
+
+// Bump when the shape of the persisted index changes.
+const CACHE_FORMAT_VERSION = 1;
+
+interface CachedMapEntry {
+  // Path of the generated file, the lookup key in the source mapper's index.
+  key: string;
+  mapFileDir: string;
+  // mtime and size of the generated file when the index was written, used
+  // to validate the entry on load.
+  mtimeMs: number;
+  size: number;
+  // Raw source map JSON for the generated file.
+  // eslint-disable-next-line @typescript-eslint/no-explicit-any
+  mapConsumer: any;
+}
+
+interface SourceMapIndex {
+  version: number;
+  searchPath: string[];
+  entries: CachedMapEntry[];
+}
+
+/**
+ * Attempts to restore a SourceMapper from the persisted index at cachePath.
+ * The index is only used when it was written for the same search path and
+ * every indexed file still has the mtime and size recorded at write time,
+ * so a stale index never mis-attributes locations. Returns undefined when
+ * the index is missing, stale, or unreadable; callers then fall back to a
+ * full scan.
+ */
+export async function loadSourceMapperFromCache(
+  cachePath: string,
+  searchPath: string[]
+): Promise<SourceMapper | undefined> {
+  let index: SourceMapIndex;
+  try {
+    index = JSON.parse((await readFile(cachePath)).toString());
+  } catch (err) {
+    return undefined;
+  }
+  if (
+    !index ||
+    index.version !== CACHE_FORMAT_VERSION ||
+    !Array.isArray(index.entries) ||
+    JSON.stringify(index.searchPath) !== JSON.stringify(searchPath)
+  ) {
+    return undefined;
+  }
+
+  const mapper = new SourceMapper();
+  // The mapper's index is populated directly; if the pprof dependency
+  // changes its internal shape, fall back to a full scan.
+  // eslint-disable-next-line @typescript-eslint/no-explicit-any
+  const infoMap = (mapper as any).infoMap;
+  if (!(infoMap instanceof Map)) {
+    return undefined;
+  }
+  for (const entry of index.entries) {
+    let stats: fs.Stats;
+    try {
+      stats = await stat(entry.key);
+    } catch (err) {
+      return undefined;
+    }
+    if (stats.mtimeMs !== entry.mtimeMs || stats.size !== entry.size) {
+      return undefined;
+    }
+    infoMap.set(entry.key, {
+      mapFileDir: entry.mapFileDir,
+      mapConsumer: entry.mapConsumer,
+    });
+  }
+  return mapper;
+}
+
+/**
+ * Persists the index of mapper to cachePath, so a later process start with
+ * the same search path can skip the recursive *.js.map scan. The index is
+ * written to a temporary file and renamed into place, so a crashed write
+ * never leaves a truncated index behind. Throws on failure; caching is
+ * best-effort and callers are expected to log and continue.
+ */
+export async function saveSourceMapperCache(
+  cachePath: string,
+  searchPath: string[],
+  mapper: SourceMapper
+): Promise<void> {
+  // eslint-disable-next-line @typescript-eslint/no-explicit-any
+  const infoMap = (mapper as any).infoMap;
+  if (!(infoMap instanceof Map)) {
+    throw new Error('Source mapper index has unexpected format.');
+  }
+  const entries: CachedMapEntry[] = [];
+  for (const [key, info] of infoMap) {
+    const stats = await stat(key);
+    entries.push({
+      key,
+      mapFileDir: info.mapFileDir,
+      mtimeMs: stats.mtimeMs,
+      size: stats.size,
+      mapConsumer: info.mapConsumer,
+    });
+  }
+  const index: SourceMapIndex = {
+    version: CACHE_FORMAT_VERSION,
+    searchPath,
+    entries,
+  };
+  const tmpPath = `${cachePath}.${process.pid}.tmp`;
+  await writeFile(tmpPath, JSON.stringify(index));
+  await rename(tmpPath, cachePath);
+}
@@ -0,0 +1,142 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as fs from 'fs';
+import * as os from 'os';
+import * as path from 'path';
+import {SourceMapper} from 'pprof';
+
+// Two bytes per JSON character is a rough but stable estimate of the
+// in-memory cost of a parsed source map.
+const BYTES_PER_CHAR = 2;
+
+interface SpilledEntry {
+  mapFileDir: string;
+  spillPath: string;
+}
+
+/**
+ * Map-shaped replacement for the source mapper's index which bounds the
+ * memory held by parsed source maps. Entries over the cap are evicted
+ * least-recently-used: the parsed map is written to a spill file and
+ * dropped from memory, and read back and re-parsed the next time a
+ * profile references its file. Iteration order of the underlying Map is
+ * insertion order, which doubles as the recency order.
+ */
+class BoundedInfoMap extends Map<string, {mapFileDir: string;
+  // eslint-disable-next-line @typescript-eslint/no-explicit-any
+  mapConsumer: any}> {
+  private entryBytes: Map<string, number> = new Map();
+  private spilled: Map<string, SpilledEntry> = new Map();
+  // Spill path assigned to each key the first time it is evicted, reused
+  // on later evictions so cache thrash does not accumulate files.
+  private spillPaths: Map<string, string> = new Map();
+  private totalBytes = 0;
+  private spillCounter = 0;
+
+  constructor(readonly maxBytes: number, readonly spillDir: string) {
+    super();
+  }
+
+  // eslint-disable-next-line @typescript-eslint/no-explicit-any
+  insert(key: string, info: {mapFileDir: string; mapConsumer: any}): void {
+    const bytes = JSON.stringify(info.mapConsumer).length * BYTES_PER_CHAR;
+    super.set(key, info);
+    this.entryBytes.set(key, bytes);
+    this.totalBytes += bytes;
+    while (this.totalBytes > this.maxBytes && super.size > 1) {
+      this.evictOldest();
+    }
+  }
+
+  private evictOldest(): void {
+    const oldest: string = super.keys().next().value;
+    const info = super.get(oldest)!;
+    let spillPath = this.spillPaths.get(oldest);
+    if (spillPath === undefined) {
+      spillPath = path.join(this.spillDir, `map-${this.spillCounter++}`);
+      this.spillPaths.set(oldest, spillPath);
+    }
+    fs.writeFileSync(spillPath, JSON.stringify(info.mapConsumer));
+    this.spilled.set(oldest, {mapFileDir: info.mapFileDir, spillPath});
+    this.totalBytes -= this.entryBytes.get(oldest)!;
+    this.entryBytes.delete(oldest);
+    super.delete(oldest);
+  }
+
+  get(key: string) {
+    const inMemory = super.get(key);
+    if (inMemory !== undefined) {
+      // Refresh recency: re-inserting moves the key to the back of the
+      // iteration (eviction) order.
+      super.delete(key);
+      super.set(key, inMemory);
+      return inMemory;
+    }
+    const spill = this.spilled.get(key);
+    if (spill === undefined) {
+      return undefined;
+    }
+    // Lookups inside the pprof profilers are synchronous, so the re-read
+    // is too. The spill file is kept and overwritten in place if the
+    // entry is evicted again, so each key owns at most one file.
+    const info = {
+      mapFileDir: spill.mapFileDir,
+      mapConsumer: JSON.parse(fs.readFileSync(spill.spillPath).toString()),
+    };
+    this.spilled.delete(key);
+    this.insert(key, info);
+    return info;
+  }
+
+  has(key: string): boolean {
+    return super.has(key) || this.spilled.has(key);
+  }
+}
+
+/**
+ * Replaces mapper's index with one which keeps at most roughly maxBytes
+ * of parsed source maps in memory, spilling the least-recently-used
+ * entries to files under a per-process temporary directory and
+ * re-parsing them on demand. Accesses pprof internals defensively:
+ * returns false, leaving the mapper untouched, when they do not have the
+ * expected shape.
+ */
+export function applySourceMapMemoryCap(
+  mapper: SourceMapper,
+  maxBytes: number
+): boolean {
+  // eslint-disable-next-line @typescript-eslint/no-explicit-any
+  const infoMap = (mapper as any).infoMap;
+  if (!(infoMap instanceof Map)) {
+    return false;
+  }
+  const spillDir = fs.mkdtempSync(
+    path.join(os.tmpdir(), 'cloud-profiler-sourcemaps-')
+  );
+  const bounded = new BoundedInfoMap(maxBytes, spillDir);
+  for (const [key, info] of infoMap) {
+    if (
+      !info ||
+      typeof info.mapFileDir !== 'string' ||
+      info.mapConsumer === undefined
+    ) {
+      return false;
+    }
+    bounded.insert(key, info);
+  }
+  // eslint-disable-next-line @typescript-eslint/no-explicit-any
+  (mapper as any).infoMap = bounded;
+  return true;
+}
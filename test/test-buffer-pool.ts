@@ -0,0 +1,65 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as assert from 'assert';
+import {describe, it} from 'mocha';
+import {promisify} from 'util';
+import * as zlib from 'zlib';
+
+import {BufferPool, gzipToBase64} from '../src/buffer-pool';
+
+const gunzip = promisify(zlib.gunzip);
+
+describe('BufferPool', () => {
+  it('should reuse a released buffer', () => {
+    const pool = new BufferPool(1024);
+    const buf = pool.acquire(100);
+    pool.release(buf, 500);
+    assert.strictEqual(buf, pool.acquire(100));
+  });
+  it('should provide at least the requested capacity', () => {
+    const pool = new BufferPool(1024);
+    const buf = pool.acquire(10000);
+    assert.ok(buf.length >= 10000);
+  });
+  it('should shrink after sustained small use', () => {
+    const pool = new BufferPool(1024);
+    let buf = pool.acquire(1024 * 1024);
+    const largeCapacity = buf.length;
+    for (let i = 0; i < 20; i++) {
+      pool.release(buf, 100);
+      buf = pool.acquire(100);
+    }
+    assert.ok(buf.length < largeCapacity);
+  });
+});
+
+describe('gzipToBase64', () => {
+  it('should round-trip input through gzip and base64', async () => {
+    const pool = new BufferPool();
+    const input = Buffer.from('profile-bytes-'.repeat(1000));
+    const base64 = await gzipToBase64(input, pool);
+    const unzipped = (await gunzip(Buffer.from(base64, 'base64'))) as Buffer;
+    assert.deepStrictEqual(input, unzipped);
+  });
+  it('should produce the same result when the pooled buffer is reused', async () => {
+    const pool = new BufferPool();
+    const first = Buffer.from('a'.repeat(100000));
+    const second = Buffer.from('b'.repeat(50000));
+    await gzipToBase64(first, pool);
+    const base64 = await gzipToBase64(second, pool);
+    const unzipped = (await gunzip(Buffer.from(base64, 'base64'))) as Buffer;
+    assert.deepStrictEqual(second, unzipped);
+  });
+});
@@ -0,0 +1,69 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as assert from 'assert';
+import {describe, it} from 'mocha';
+import * as zlib from 'zlib';
+
+import {codecAvailable, createCompressor} from '../src/compression';
+
+const input = Buffer.from('profile bytes '.repeat(1000));
+
+describe('createCompressor', () => {
+  it('should compress with gzip at the requested level', async () => {
+    const compressor = createCompressor('gzip', 1);
+    assert.strictEqual('gzip', compressor.codec);
+    const compressed = await compressor.compress(input);
+    assert.deepStrictEqual(input, zlib.gunzipSync(compressed));
+    assert.deepStrictEqual(
+      input,
+      zlib.gunzipSync(compressor.compressSync(input))
+    );
+  });
+  it('should compress through the stream interface', async () => {
+    const stream = createCompressor('gzip').createStream();
+    const chunks: Buffer[] = [];
+    stream.on('data', (chunk: Buffer) => chunks.push(chunk));
+    const done = new Promise<void>((resolve, reject) => {
+      stream.on('end', resolve);
+      stream.on('error', reject);
+    });
+    stream.end(input);
+    await done;
+    assert.deepStrictEqual(input, zlib.gunzipSync(Buffer.concat(chunks)));
+  });
+  it('should compress with brotli when available', async () => {
+    if (!codecAvailable('brotli')) {
+      return;
+    }
+    const compressor = createCompressor('brotli', 2);
+    assert.strictEqual('brotli', compressor.codec);
+    const compressed = await compressor.compress(input);
+    assert.deepStrictEqual(input, zlib.brotliDecompressSync(compressed));
+  });
+  it('should use zstd when available and gzip otherwise', async () => {
+    const compressor = createCompressor('zstd', 3);
+    if (!codecAvailable('zstd')) {
+      assert.strictEqual('gzip', compressor.codec);
+      return;
+    }
+    assert.strictEqual('zstd', compressor.codec);
+    const compressed = await compressor.compress(input);
+    assert.deepStrictEqual(
+      input,
+      // eslint-disable-next-line @typescript-eslint/no-explicit-any
+      (zlib as any).zstdDecompressSync(compressed)
+    );
+  });
+});
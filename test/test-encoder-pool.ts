@@ -0,0 +1,84 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as assert from 'assert';
+import {describe, it} from 'mocha';
+import * as zlib from 'zlib';
+
+import {perftools} from '../protos/profile';
+import {EncoderPool} from '../src/encoder-pool';
+
+import {heapProfile, timeProfile} from './profiles-for-tests';
+
+function decode(bytes: Buffer): perftools.profiles.Profile {
+  return perftools.profiles.Profile.decode(zlib.gunzipSync(bytes));
+}
+
+function referenceDecode(
+  p: perftools.profiles.IProfile
+): perftools.profiles.Profile {
+  return perftools.profiles.Profile.decode(
+    Buffer.from(perftools.profiles.Profile.encode(p).finish())
+  );
+}
+
+describe('EncoderPool', () => {
+  it('should round-trip a profile through the worker', async () => {
+    const pool = new EncoderPool();
+    try {
+      assert.deepStrictEqual(
+        referenceDecode(timeProfile),
+        decode(await pool.encode(timeProfile))
+      );
+    } finally {
+      pool.stop();
+    }
+  });
+  it('should encode correctly when a cache key is reused', async () => {
+    const pool = new EncoderPool();
+    try {
+      assert.deepStrictEqual(
+        referenceDecode(heapProfile),
+        decode(await pool.encode(heapProfile, 'heap'))
+      );
+      // Same tables as the previous profile with this key: the worker
+      // encodes incrementally on this call.
+      assert.deepStrictEqual(
+        referenceDecode(heapProfile),
+        decode(await pool.encode(heapProfile, 'heap'))
+      );
+    } finally {
+      pool.stop();
+    }
+  });
+  it('should reject outstanding encodes when stopped', async () => {
+    const pool = new EncoderPool();
+    const pending = pool.encode(timeProfile);
+    pool.stop();
+    await assert.rejects(pending);
+  });
+  it('should start a fresh worker after being stopped', async () => {
+    const pool = new EncoderPool();
+    try {
+      await pool.encode(timeProfile);
+      pool.stop();
+      assert.deepStrictEqual(
+        referenceDecode(timeProfile),
+        decode(await pool.encode(timeProfile))
+      );
+    } finally {
+      pool.stop();
+    }
+  });
+});
@@ -0,0 +1,61 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as assert from 'assert';
+import {describe, it} from 'mocha';
+import * as sinon from 'sinon';
+
+import {EndpointSelector} from '../src/endpoint-selector';
+
+const ENDPOINTS = ['primary.example.com', 'fallback.example.com'];
+
+describe('EndpointSelector', () => {
+  it('should prefer the first endpoint', () => {
+    const selector = new EndpointSelector(ENDPOINTS);
+    assert.strictEqual('primary.example.com', selector.primary());
+    assert.strictEqual(
+      'fallback.example.com',
+      selector.fallback('primary.example.com')
+    );
+  });
+  it('should have no fallback with a single endpoint', () => {
+    const selector = new EndpointSelector(['primary.example.com']);
+    assert.strictEqual(undefined, selector.fallback('primary.example.com'));
+  });
+  it('should fail over after a failure and recover on success', () => {
+    const selector = new EndpointSelector(ENDPOINTS);
+    selector.markFailure('primary.example.com');
+    assert.strictEqual('fallback.example.com', selector.primary());
+    selector.markSuccess('primary.example.com');
+    assert.strictEqual('primary.example.com', selector.primary());
+  });
+  it('should return to a failed endpoint after its cool-down', () => {
+    const clock = sinon.useFakeTimers();
+    try {
+      const selector = new EndpointSelector(ENDPOINTS);
+      selector.markFailure('primary.example.com');
+      assert.strictEqual('fallback.example.com', selector.primary());
+      clock.tick(61 * 1000);
+      assert.strictEqual('primary.example.com', selector.primary());
+    } finally {
+      clock.restore();
+    }
+  });
+  it('should use the first endpoint when all are cooling down', () => {
+    const selector = new EndpointSelector(ENDPOINTS);
+    selector.markFailure('primary.example.com');
+    selector.markFailure('fallback.example.com');
+    assert.strictEqual('primary.example.com', selector.primary());
+  });
+});
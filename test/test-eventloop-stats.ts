@@ -0,0 +1,73 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as assert from 'assert';
+import {describe, it} from 'mocha';
+import * as perfHooks from 'perf_hooks';
+
+import {EventLoopStatsSampler} from '../src/eventloop-stats';
+
+describe('EventLoopStatsSampler', () => {
+  it('should report lag labels with numeric values', async () => {
+    // eslint-disable-next-line @typescript-eslint/no-explicit-any
+    if (typeof (perfHooks as any).monitorEventLoopDelay !== 'function') {
+      return;
+    }
+    const sampler = new EventLoopStatsSampler();
+    sampler.start();
+    await new Promise(resolve => setTimeout(resolve, 50));
+    const labels = sampler.stop();
+    assert.ok(!isNaN(Number(labels['event_loop_lag_p50_ms'])));
+    assert.ok(!isNaN(Number(labels['event_loop_lag_max_ms'])));
+    assert.ok(
+      Number(labels['event_loop_lag_max_ms']) >=
+        Number(labels['event_loop_lag_p50_ms'])
+    );
+  });
+  it('should report utilization within [0, 1]', async () => {
+    // eslint-disable-next-line @typescript-eslint/no-explicit-any
+    const performance = (perfHooks as any).performance;
+    if (
+      !performance ||
+      typeof performance.eventLoopUtilization !== 'function'
+    ) {
+      return;
+    }
+    const sampler = new EventLoopStatsSampler();
+    sampler.start();
+    await new Promise(resolve => setTimeout(resolve, 50));
+    const utilization = Number(sampler.stop()['event_loop_utilization']);
+    assert.ok(utilization >= 0 && utilization <= 1);
+  });
+  it('should measure each window independently', async () => {
+    // eslint-disable-next-line @typescript-eslint/no-explicit-any
+    if (typeof (perfHooks as any).monitorEventLoopDelay !== 'function') {
+      return;
+    }
+    const sampler = new EventLoopStatsSampler();
+    sampler.start();
+    // Block the loop so the first window observes lag.
+    const until = Date.now() + 60;
+    while (Date.now() < until) {}
+    await new Promise(resolve => setTimeout(resolve, 20));
+    const blocked = sampler.stop();
+    sampler.start();
+    await new Promise(resolve => setTimeout(resolve, 50));
+    const idle = sampler.stop();
+    assert.ok(
+      Number(idle['event_loop_lag_max_ms']) <
+        Number(blocked['event_loop_lag_max_ms'])
+    );
+  });
+});
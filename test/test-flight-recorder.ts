@@ -0,0 +1,68 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as assert from 'assert';
+import * as fs from 'fs';
+import {describe, it} from 'mocha';
+import * as os from 'os';
+import * as path from 'path';
+
+import {FlightRecorder} from '../src/flight-recorder';
+
+function makeDir(): string {
+  return fs.mkdtempSync(path.join(os.tmpdir(), 'flight-recorder-test-'));
+}
+
+function recordedFiles(dir: string): string[] {
+  return fs
+    .readdirSync(dir)
+    .filter(f => f.startsWith('profile-'))
+    .sort();
+}
+
+describe('FlightRecorder', () => {
+  it('should write one file per recorded profile', async () => {
+    const dir = makeDir();
+    const recorder = new FlightRecorder(dir);
+    await recorder.record('WALL', Buffer.from('wall-profile'));
+    await recorder.record('HEAP', Buffer.from('heap-profile'), 'pb.br');
+    const files = recordedFiles(dir);
+    assert.strictEqual(2, files.length);
+    assert.ok(files[0].endsWith('-wall.pb.gz'));
+    assert.ok(files[1].endsWith('-heap.pb.br'));
+    assert.strictEqual(
+      'wall-profile',
+      fs.readFileSync(path.join(dir, files[0])).toString()
+    );
+  });
+  it('should evict the oldest files once over budget', async () => {
+    const dir = makeDir();
+    const recorder = new FlightRecorder(dir, 25);
+    await recorder.record('WALL', Buffer.from('0123456789'));
+    await recorder.record('WALL', Buffer.from('0123456789'));
+    assert.strictEqual(2, recordedFiles(dir).length);
+    await recorder.record('WALL', Buffer.from('0123456789'));
+    assert.strictEqual(2, recordedFiles(dir).length);
+  });
+  it('should count files from a previous run against the budget', async () => {
+    const dir = makeDir();
+    const previous = new FlightRecorder(dir, 100);
+    await previous.record('WALL', Buffer.from('0123456789'));
+    const recorder = new FlightRecorder(dir, 15);
+    await recorder.record('WALL', Buffer.from('0123456789'));
+    const files = recordedFiles(dir);
+    assert.strictEqual(1, files.length);
+    assert.ok(files[0].endsWith('-wall.pb.gz'));
+  });
+});
@@ -0,0 +1,57 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as assert from 'assert';
+import {describe, it} from 'mocha';
+
+import {HeapIntervalController} from '../src/heap-controller';
+
+describe('HeapIntervalController', () => {
+  it('should start at the configured interval', () => {
+    const controller = new HeapIntervalController(512 * 1024, 100);
+    assert.strictEqual(512 * 1024, controller.currentIntervalBytes());
+  });
+  it('should widen the interval when profiles oversample', () => {
+    const controller = new HeapIntervalController(512 * 1024, 100);
+    const intervalBytes = controller.record(1000);
+    assert.ok(intervalBytes !== undefined);
+    assert.ok(intervalBytes! > 512 * 1024);
+  });
+  it('should narrow the interval when profiles undersample', () => {
+    const controller = new HeapIntervalController(512 * 1024, 100);
+    const intervalBytes = controller.record(10);
+    assert.ok(intervalBytes !== undefined);
+    assert.ok(intervalBytes! < 512 * 1024);
+  });
+  it('should not report changes too small to justify a restart', () => {
+    const controller = new HeapIntervalController(512 * 1024, 100);
+    assert.strictEqual(undefined, controller.record(105));
+  });
+  it('should keep the interval within bounds', () => {
+    const controller = new HeapIntervalController(512 * 1024, 100);
+    for (let i = 0; i < 50; i++) {
+      controller.record(100000);
+    }
+    assert.ok(controller.currentIntervalBytes() <= 16 * 512 * 1024);
+    for (let i = 0; i < 50; i++) {
+      controller.record(1);
+    }
+    assert.ok(controller.currentIntervalBytes() >= (512 * 1024) / 16);
+  });
+  it('should ignore empty profiles', () => {
+    const controller = new HeapIntervalController(512 * 1024, 100);
+    assert.strictEqual(undefined, controller.record(0));
+    assert.strictEqual(512 * 1024, controller.currentIntervalBytes());
+  });
+});
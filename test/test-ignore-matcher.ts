@@ -0,0 +1,82 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as assert from 'assert';
+import {describe, it} from 'mocha';
+
+import {perftools} from '../protos/profile';
+import {IgnoreMatcher, removeIgnoredSamples} from '../src/ignore-matcher';
+
+describe('IgnoreMatcher', () => {
+  it('should match any of the patterns as a substring', () => {
+    const matcher = new IgnoreMatcher(['node_modules/grpc', 'metrics-client']);
+    assert.ok(matcher.matches('/srv/node_modules/grpc/src/client.js'));
+    assert.ok(matcher.matches('/srv/node_modules/metrics-client/index.js'));
+    assert.ok(!matcher.matches('/srv/build/src/server.js'));
+  });
+  it('should match overlapping patterns', () => {
+    const matcher = new IgnoreMatcher(['abcd', 'bce']);
+    assert.ok(matcher.matches('xabcex'));
+    assert.ok(matcher.matches('xabcdx'));
+    assert.ok(!matcher.matches('xabx'));
+  });
+  it('should match a pattern which suffixes another', () => {
+    const matcher = new IgnoreMatcher(['aab', 'ab']);
+    assert.ok(matcher.matches('xxab'));
+  });
+  it('should not match anything when built from empty patterns', () => {
+    const matcher = new IgnoreMatcher(['']);
+    assert.ok(!matcher.matches('anything'));
+  });
+});
+
+describe('removeIgnoredSamples', () => {
+  // Two samples: one through app.js (location 1), one through a frame in
+  // ignored.js (location 2).
+  function testProfile(): perftools.profiles.IProfile {
+    return {
+      stringTable: ['', 'app.js', 'ignored.js', 'main', 'helper'],
+      function: [
+        new perftools.profiles.Function({id: 1, name: 3, filename: 1}),
+        new perftools.profiles.Function({id: 2, name: 4, filename: 2}),
+      ],
+      location: [
+        new perftools.profiles.Location({
+          id: 1,
+          line: [{functionId: 1, line: 1}],
+        }),
+        new perftools.profiles.Location({
+          id: 2,
+          line: [{functionId: 2, line: 1}],
+        }),
+      ],
+      sample: [
+        new perftools.profiles.Sample({locationId: [1], value: [1, 10]}),
+        new perftools.profiles.Sample({locationId: [1, 2], value: [2, 20]}),
+      ],
+    };
+  }
+
+  it('should drop samples with a frame in an ignored file', () => {
+    const p = testProfile();
+    removeIgnoredSamples(p, new IgnoreMatcher(['ignored.js']));
+    assert.strictEqual(1, p.sample!.length);
+    assert.deepStrictEqual([1], p.sample![0].locationId);
+  });
+  it('should keep all samples when nothing matches', () => {
+    const p = testProfile();
+    removeIgnoredSamples(p, new IgnoreMatcher(['no-such-file']));
+    assert.strictEqual(2, p.sample!.length);
+  });
+});
@@ -58,11 +58,18 @@ describe('createProfiler', () => {
     initialBackoffMillis: 1000 * 60,
     backoffCapMillis: 60 * 60 * 1000,
     backoffMultiplier: 1.3,
+    binaryUpload: false,
+    keepAlive: true,
+    maxPendingUploads: 2,
+    uploadRetryQueueSize: 5,
     serverBackoffCapMillis: 2147483647,
     localProfilingPeriodMillis: 1000,
     localTimeDurationMillis: 1000,
     localLogPeriodMillis: 10000,
     apiEndpoint: 'cloudprofiler.googleapis.com',
+    deferSourceMaps: false,
+    disableEncodeWorker: false,
+    streamingEncode: false,
   };
   const disableSourceMapParams = {
     sourceMapSearchPath: ['path'],
@@ -317,6 +324,36 @@ describe('createProfiler', () => {
     assert.deepStrictEqual(profiler.config, expConfig);
   });
 
+  it('should construct profiler before metadata is resolved when deferMetadata is set', async () => {
+    instanceMetadataStub = sinon.stub(gcpMetadata, 'instance');
+    instanceMetadataStub
+      .withArgs('name')
+      .resolves('gce-instance')
+      .withArgs('zone')
+      .resolves('projects/123456789012/zones/gce-zone');
+    projectMetadataStub = sinon.stub(gcpMetadata, 'project');
+    projectMetadataStub.withArgs('project-id').resolves('gce-project');
+    const config = Object.assign(
+      {
+        logLevel: 2,
+        serviceContext: {version: '', service: 'fake-service'},
+        disableHeap: true,
+        disableTime: true,
+        deferMetadata: true,
+      },
+      disableSourceMapParams
+    );
+
+    const profiler: Profiler = await createProfiler(config);
+    assert.strictEqual(undefined, profiler.config.projectId);
+
+    // Metadata resolution completes in the background.
+    await new Promise(resolve => setImmediate(resolve));
+    assert.strictEqual('gce-project', profiler.config.projectId);
+    assert.strictEqual('gce-instance', profiler.config.instance);
+    assert.strictEqual('gce-zone', profiler.config.zone);
+  });
+
   it('should reject when sourceMapSearchPaths is empty array and source map support is enabled', async () => {
     instanceMetadataStub = sinon.stub(gcpMetadata, 'instance');
     instanceMetadataStub.throwsException('cannot access metadata');
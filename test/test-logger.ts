@@ -0,0 +1,88 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as assert from 'assert';
+import {describe, it} from 'mocha';
+
+import {BatchedLogSink, makeBatchedLogger} from '../src/logger';
+
+function collectingSink(
+  batches: string[],
+  maxBufferedLines?: number
+): BatchedLogSink {
+  return new BatchedLogSink((chunk, callback) => {
+    batches.push(chunk);
+    setImmediate(callback);
+  }, maxBufferedLines);
+}
+
+function parseLines(batches: string[]): Array<{[key: string]: string}> {
+  return batches
+    .join('')
+    .split('\n')
+    .filter(l => l.length > 0)
+    .map(l => JSON.parse(l));
+}
+
+describe('BatchedLogSink', () => {
+  it('should write buffered lines as one structured batch', async () => {
+    const batches: string[] = [];
+    const sink = collectingSink(batches);
+    const logger = makeBatchedLogger(4, sink);
+    logger.debug('first %d', 1);
+    logger.warn('second');
+    await sink.flush();
+    assert.strictEqual(1, batches.length);
+    const lines = parseLines(batches);
+    assert.strictEqual(2, lines.length);
+    assert.strictEqual('debug', lines[0].severity);
+    assert.strictEqual('first 1', lines[0].message);
+    assert.strictEqual('warn', lines[1].severity);
+    assert.ok(!isNaN(Date.parse(lines[0].time)));
+  });
+  it('should suppress lines above the configured level', async () => {
+    const batches: string[] = [];
+    const sink = collectingSink(batches);
+    const logger = makeBatchedLogger(2, sink);
+    logger.debug('suppressed');
+    logger.info('suppressed');
+    logger.error('kept');
+    await sink.flush();
+    const lines = parseLines(batches);
+    assert.strictEqual(1, lines.length);
+    assert.strictEqual('error', lines[0].severity);
+  });
+  it('should drop lines on overflow and report the count', async () => {
+    const batches: string[] = [];
+    const sink = collectingSink(batches, 2);
+    const logger = makeBatchedLogger(4, sink);
+    logger.debug('one');
+    logger.debug('two');
+    logger.debug('dropped');
+    logger.debug('dropped');
+    await sink.flush();
+    const lines = parseLines(batches);
+    assert.strictEqual(3, lines.length);
+    assert.strictEqual('warn', lines[2].severity);
+    assert.ok(lines[2].message.includes('Dropped 2 log lines'));
+  });
+  it('should flush on the timer without an explicit flush', async () => {
+    const batches: string[] = [];
+    const sink = collectingSink(batches);
+    const logger = makeBatchedLogger(4, sink);
+    logger.debug('timed');
+    await new Promise(resolve => setTimeout(resolve, 200));
+    assert.strictEqual(1, parseLines(batches).length);
+  });
+});
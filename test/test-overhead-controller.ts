@@ -0,0 +1,53 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as assert from 'assert';
+import {describe, it} from 'mocha';
+
+import {OverheadController} from '../src/overhead-controller';
+
+describe('OverheadController', () => {
+  it('should start at the configured interval', () => {
+    const controller = new OverheadController(1000, 1);
+    assert.strictEqual(1000, controller.currentIntervalMicros());
+  });
+  it('should back off when overhead exceeds the budget', () => {
+    const controller = new OverheadController(1000, 1);
+    // 5% observed overhead against a 1% budget over a 10s window.
+    controller.record(500000, 10 * 1e6);
+    assert.ok(controller.currentIntervalMicros() > 1000);
+  });
+  it('should tighten the interval when headroom exists', () => {
+    const controller = new OverheadController(1000, 1);
+    // 0.01% observed overhead against a 1% budget.
+    controller.record(1000, 10 * 1e6);
+    assert.ok(controller.currentIntervalMicros() < 1000);
+  });
+  it('should keep the interval within bounds', () => {
+    const controller = new OverheadController(1000, 1);
+    for (let i = 0; i < 50; i++) {
+      controller.record(0, 10 * 1e6);
+    }
+    assert.ok(controller.currentIntervalMicros() >= 100);
+    for (let i = 0; i < 50; i++) {
+      controller.record(10 * 1e6, 10 * 1e6);
+    }
+    assert.ok(controller.currentIntervalMicros() <= 100000);
+  });
+  it('should ignore cycles with no duration', () => {
+    const controller = new OverheadController(1000, 1);
+    controller.record(500, 0);
+    assert.strictEqual(1000, controller.currentIntervalMicros());
+  });
+});
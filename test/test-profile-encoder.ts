@@ -0,0 +1,98 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as assert from 'assert';
+import {describe, it} from 'mocha';
+import * as extend from 'extend';
+
+import {perftools} from '../protos/profile';
+import {encodeProfileChunked, ProfileEncoder} from '../src/profile-encoder';
+
+import {heapProfile, timeProfile} from './profiles-for-tests';
+
+function decode(bytes: Buffer): perftools.profiles.Profile {
+  return perftools.profiles.Profile.decode(bytes);
+}
+
+function referenceDecode(
+  p: perftools.profiles.IProfile
+): perftools.profiles.Profile {
+  return decode(
+    Buffer.from(perftools.profiles.Profile.encode(p).finish())
+  );
+}
+
+describe('ProfileEncoder', () => {
+  it('should encode a profile identically to the generated encoder', () => {
+    const encoder = new ProfileEncoder();
+    assert.deepStrictEqual(
+      referenceDecode(heapProfile),
+      decode(encoder.encode(heapProfile))
+    );
+  });
+  it('should encode time profiles', () => {
+    const encoder = new ProfileEncoder();
+    assert.deepStrictEqual(
+      referenceDecode(timeProfile),
+      decode(encoder.encode(timeProfile))
+    );
+  });
+  it('should encode correctly when table entries are reused', () => {
+    const encoder = new ProfileEncoder();
+    encoder.encode(heapProfile);
+
+    // Same tables, different sample values: the table bytes come from the
+    // encoder's cache on the second encode.
+    const next: perftools.profiles.IProfile = extend(true, {}, heapProfile);
+    next.sample![0].value = [100, 200];
+    assert.deepStrictEqual(referenceDecode(next), decode(encoder.encode(next)));
+  });
+  it('should encode correctly after tables change', () => {
+    const encoder = new ProfileEncoder();
+    encoder.encode(heapProfile);
+
+    const next: perftools.profiles.IProfile = extend(true, {}, heapProfile);
+    next.stringTable!.push('new-function');
+    next['function']!.push(
+      new perftools.profiles.Function({
+        id: 100,
+        name: next.stringTable!.length - 1,
+        systemName: next.stringTable!.length - 1,
+        filename: 0,
+      })
+    );
+    assert.deepStrictEqual(referenceDecode(next), decode(encoder.encode(next)));
+  });
+  it('should encode repeatedly without growing unbounded', () => {
+    const encoder = new ProfileEncoder();
+    for (let i = 0; i < 5; i++) {
+      assert.deepStrictEqual(
+        referenceDecode(heapProfile),
+        decode(encoder.encode(heapProfile))
+      );
+    }
+  });
+});
+
+describe('encodeProfileChunked', () => {
+  it('should produce batches which concatenate to the profile', async () => {
+    const batches: Buffer[] = [];
+    await encodeProfileChunked(timeProfile, batch => batches.push(batch));
+    assert.ok(batches.length > 0);
+    assert.deepStrictEqual(
+      referenceDecode(timeProfile),
+      decode(Buffer.concat(batches))
+    );
+  });
+});
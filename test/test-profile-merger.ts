@@ -0,0 +1,78 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as assert from 'assert';
+import {describe, it} from 'mocha';
+
+import {perftools} from '../protos/profile';
+import {mergeProfiles} from '../src/profile-merger';
+
+import {timeProfile} from './profiles-for-tests';
+
+describe('mergeProfiles', () => {
+  it('should merge two threads, unioning tables and tagging samples', () => {
+    const merged = mergeProfiles([
+      {profile: timeProfile, threadLabel: 'worker-0'},
+      {profile: timeProfile, threadLabel: 'worker-1'},
+    ]);
+
+    // Identical tables collapse; samples concatenate.
+    assert.strictEqual(timeProfile.location!.length, merged.location!.length);
+    assert.strictEqual(
+      timeProfile['function']!.length,
+      merged['function']!.length
+    );
+    assert.strictEqual(timeProfile.sample!.length * 2, merged.sample!.length);
+
+    const strings = merged.stringTable!;
+    for (const [i, sample] of merged.sample!.entries()) {
+      const threadLabels = sample.label!.filter(
+        l => strings[l.key as number] === 'thread'
+      );
+      assert.strictEqual(1, threadLabels.length);
+      assert.strictEqual(
+        i < timeProfile.sample!.length ? 'worker-0' : 'worker-1',
+        strings[threadLabels[0].str as number]
+      );
+    }
+
+    // Sample values and stacks survive the remapping.
+    const firstIn = timeProfile.sample![0];
+    const firstOut = merged.sample![0];
+    assert.deepStrictEqual(firstIn.value, firstOut.value);
+    assert.strictEqual(
+      firstIn.locationId!.length,
+      firstOut.locationId!.length
+    );
+
+    // The merged profile still encodes and decodes cleanly.
+    const decoded = perftools.profiles.Profile.decode(
+      perftools.profiles.Profile.encode(merged).finish()
+    );
+    assert.strictEqual(merged.sample!.length, decoded.sample.length);
+  });
+  it('should preserve sample types and period', () => {
+    const merged = mergeProfiles([{profile: timeProfile}]);
+    const strings = merged.stringTable!;
+    assert.strictEqual(
+      'sample',
+      strings[merged.sampleType![0].type as number]
+    );
+    assert.strictEqual('wall', strings[merged.sampleType![1].type as number]);
+    assert.strictEqual(timeProfile.period, merged.period);
+  });
+  it('should reject an empty input list', () => {
+    assert.throws(() => mergeProfiles([]));
+  });
+});
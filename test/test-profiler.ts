@@ -23,11 +23,14 @@ import * as extend from 'extend';
 import * as nock from 'nock';
 import {heap as heapProfiler, time as timeProfiler} from 'pprof';
 import * as sinon from 'sinon';
+import * as r from 'teeny-request';
 import {promisify} from 'util';
 import * as zlib from 'zlib';
 
 import {perftools} from '../protos/profile';
+import {google} from '../protos/profiler';
 import {ProfilerConfig} from '../src/config';
+import {Metrics} from '../src/metrics';
 import {parseBackoffDuration, Profiler, Retryer} from '../src/profiler';
 
 import {
@@ -63,12 +66,19 @@ const testConfig: ProfilerConfig = {
   initialBackoffMillis: 1000,
   backoffCapMillis: parseDuration('1h')!,
   backoffMultiplier: 1.3,
+  binaryUpload: false,
+  keepAlive: true,
+  maxPendingUploads: 1,
+  uploadRetryQueueSize: 0,
   serverBackoffCapMillis: parseDuration('7d')!,
   localProfilingPeriodMillis: 1000,
   localTimeDurationMillis: 1000,
   localLogPeriodMillis: 1000,
   sourceMapSearchPath: [],
   disableSourceMaps: true,
+  deferSourceMaps: false,
+  disableEncodeWorker: true,
+  streamingEncode: false,
   apiEndpoint: API,
 };
 
@@ -312,6 +322,122 @@ describe('Profiler', () => {
       uploaded.profileBytes = undefined;
       assert.deepStrictEqual(uploaded, requestProf);
     });
+    it('should record self-telemetry for the cycle.', async () => {
+      const requestProf = {
+        name: 'projects/12345678901/test-projectId',
+        duration: '10s',
+        profileType: 'WALL',
+        labels: {instance: 'test-instance'},
+      };
+
+      requestStub = sinon
+        .stub(common.ServiceObject.prototype, 'request')
+        .onCall(0)
+        .callsArgWith(1, null, {}, {statusCode: 200});
+
+      const metricsSnapshots: Metrics[] = [];
+      const profiler = new Profiler(
+        Object.assign({}, testConfig, {
+          metricsCallback: (m: Metrics) => metricsSnapshots.push(m),
+        })
+      );
+      await profiler.profileAndUpload(requestProf);
+
+      const metrics = profiler.getMetrics();
+      assert.strictEqual(1, metrics.profilesCollected);
+      assert.strictEqual(1, metrics.profilesUploaded);
+      assert.strictEqual(0, metrics.uploadErrors);
+      assert.ok(metrics.uploadedBytes > 0);
+      assert.strictEqual(1, metrics.serializeMillis.count);
+      assert.strictEqual(1, metrics.uploadMillis.count);
+      assert.strictEqual(1, metricsSnapshots.length);
+      assert.deepStrictEqual(metrics, metricsSnapshots[0]);
+    });
+    it(
+      'should retry a queued upload after a later upload succeeds when' +
+        ' uploadRetryQueueSize is set.',
+      async () => {
+        const randomStub = sinon.stub(Math, 'random').returns(0.5);
+        try {
+          const requestProf1 = {
+            name: 'projects/12345678901/test-projectId',
+            duration: '10s',
+            profileType: 'WALL',
+            labels: {instance: 'test-instance'},
+          };
+          const requestProf2 = {
+            name: 'projects/12345678901/test-projectId',
+            profileType: 'HEAP',
+            labels: {instance: 'test-instance'},
+          };
+          requestStub = sinon
+            .stub(common.ServiceObject.prototype, 'request')
+            .onCall(0)
+            .callsArgWith(1, null, {}, {statusCode: 503})
+            .onCall(1)
+            .callsArgWith(1, null, {}, {statusCode: 200})
+            .onCall(2)
+            .callsArgWith(1, null, {}, {statusCode: 200});
+
+          const config = extend(true, {}, testConfig);
+          config.uploadRetryQueueSize = 5;
+          const profiler = new Profiler(config);
+          await profiler.profileAndUpload(requestProf1);
+          assert.strictEqual(1, requestStub.callCount);
+
+          // The next successful upload drains the retry queue.
+          await profiler.profileAndUpload(requestProf2);
+          assert.strictEqual(3, requestStub.callCount);
+          const retried = requestStub.thirdCall.args[0].body as {
+            profileType?: string;
+          };
+          assert.strictEqual('WALL', retried.profileType);
+        } finally {
+          randomStub.restore();
+        }
+      }
+    );
+    it(
+      'should upload profile as a binary Profile message when binaryUpload' +
+        ' is set.',
+      async () => {
+        const requestProf = {
+          name: 'projects/12345678901/test-projectId',
+          duration: '10s',
+          profileType: 'WALL',
+          labels: {instance: 'test-instance'},
+        };
+
+        requestStub = sinon
+          .stub(common.ServiceObject.prototype, 'request')
+          .onCall(0)
+          .callsArgWith(1, null, {}, {statusCode: 200});
+
+        const config = extend(true, {}, testConfig);
+        config.binaryUpload = true;
+        const profiler = new Profiler(config);
+        await profiler.profileAndUpload(requestProf);
+
+        const options = requestStub.firstCall.args[0];
+        assert.strictEqual(undefined, options.json);
+        const uploaded = google.devtools.cloudprofiler.v2.Profile.decode(
+          options.body as Buffer
+        );
+        assert.strictEqual(
+          'projects/12345678901/test-projectId',
+          uploaded.name
+        );
+        assert.strictEqual(
+          google.devtools.cloudprofiler.v2.ProfileType.WALL,
+          uploaded.profileType
+        );
+        const unzippedBytes = (await promisify(zlib.gunzip)(
+          Buffer.from(uploaded.profileBytes)
+        )) as Uint8Array;
+        const outProfile = perftools.profiles.Profile.decode(unzippedBytes);
+        assert.deepStrictEqual(decodedTimeProfile, outProfile);
+      }
+    );
     it('should send request to upload heap profile.', async () => {
       const requestProf = {
         name: 'projects/12345678901/test-projectId',
@@ -880,6 +1006,64 @@ describe('Profiler', () => {
         assert.strictEqual(parseDuration('7d'), delayMillis);
       }
     );
+    it('should cancel an in-flight createProfile when stopped', async () => {
+      requestStub = sinon
+        .stub(common.ServiceObject.prototype, 'request')
+        .onCall(0)
+        // Hang, like the long-poll does until the server assigns a profile.
+        .callsFake(() => {});
+
+      const profiler = new Profiler(testConfig);
+      const pending = profiler.collectProfile();
+      profiler.stop();
+      const delayMillis = await pending;
+      assert.strictEqual(
+        0,
+        delayMillis,
+        'Cancelled profile creation should not back off'
+      );
+    });
+    it(
+      'should start next poll before upload completes when maxPendingUploads' +
+        ' is greater than 1',
+      async () => {
+        const createProfileResponseBody = {
+          name: 'projects/12345678901/test-projectId',
+          profileType: 'WALL',
+          duration: '10s',
+          labels: {instance: testConfig.instance},
+        };
+        let uploadCallback: BodyResponseCallback | undefined;
+        requestStub = sinon
+          .stub(common.ServiceObject.prototype, 'request')
+          .onCall(0)
+          .callsArgWith(1, undefined, createProfileResponseBody, {
+            statusCode: 200,
+          })
+          .onCall(1)
+          .callsFake((_options: DecorateRequestOptions, cb) => {
+            uploadCallback = cb;
+          });
+
+        const config = extend(true, {}, testConfig);
+        config.maxPendingUploads = 2;
+        const profiler = new Profiler(config);
+        const delayMillis = await profiler.collectProfile();
+        assert.strictEqual(
+          0,
+          delayMillis,
+          'No delay before asking to collect next profile'
+        );
+
+        // collectProfile resolved while the upload PATCH was still
+        // outstanding; wait for the upload to be issued and complete it so
+        // no work is pending when the test ends.
+        while (uploadCallback === undefined) {
+          await new Promise(resolve => setImmediate(resolve));
+        }
+        uploadCallback(null, undefined, {statusCode: 200} as r.Response);
+      }
+    );
     it(
       'should indicate collectProfile should be called immediately if there' +
         ' is an error when collecting and uploading profile.',
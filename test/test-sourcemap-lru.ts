@@ -0,0 +1,81 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+import * as assert from 'assert';
+import * as fs from 'fs';
+import {describe, it} from 'mocha';
+import {SourceMapper} from 'pprof';
+
+import {applySourceMapMemoryCap} from '../src/sourcemap-lru';
+
+// eslint-disable-next-line @typescript-eslint/no-explicit-any
+function fakeMapper(entries: Array<[string, any]>): SourceMapper {
+  return ({infoMap: new Map(entries)} as unknown) as SourceMapper;
+}
+
+function consumer(name: string) {
+  return {version: 3, file: name, mappings: 'A'.repeat(100)};
+}
+
+describe('applySourceMapMemoryCap', () => {
+  it('should keep all entries under the cap', () => {
+    const mapper = fakeMapper([
+      ['a.js', {mapFileDir: '/maps', mapConsumer: consumer('a')}],
+      ['b.js', {mapFileDir: '/maps', mapConsumer: consumer('b')}],
+    ]);
+    assert.ok(applySourceMapMemoryCap(mapper, 100 * 1024));
+    // eslint-disable-next-line @typescript-eslint/no-explicit-any
+    const infoMap = (mapper as any).infoMap;
+    assert.ok(infoMap.has('a.js'));
+    assert.ok(infoMap.has('b.js'));
+    assert.deepStrictEqual(consumer('a'), infoMap.get('a.js').mapConsumer);
+  });
+  it('should evict over the cap and re-load evicted entries', () => {
+    const mapper = fakeMapper([
+      ['a.js', {mapFileDir: '/maps', mapConsumer: consumer('a')}],
+      ['b.js', {mapFileDir: '/maps', mapConsumer: consumer('b')}],
+      ['c.js', {mapFileDir: '/maps', mapConsumer: consumer('c')}],
+    ]);
+    // Roughly one entry's worth of budget: older entries spill.
+    assert.ok(applySourceMapMemoryCap(mapper, 300));
+    // eslint-disable-next-line @typescript-eslint/no-explicit-any
+    const infoMap = (mapper as any).infoMap;
+    assert.ok(infoMap.has('a.js'));
+    const reloaded = infoMap.get('a.js');
+    assert.strictEqual('/maps', reloaded.mapFileDir);
+    assert.deepStrictEqual(consumer('a'), reloaded.mapConsumer);
+  });
+  it('should not accumulate spill files under cache thrash', () => {
+    const mapper = fakeMapper([
+      ['a.js', {mapFileDir: '/maps', mapConsumer: consumer('a')}],
+      ['b.js', {mapFileDir: '/maps', mapConsumer: consumer('b')}],
+      ['c.js', {mapFileDir: '/maps', mapConsumer: consumer('c')}],
+    ]);
+    assert.ok(applySourceMapMemoryCap(mapper, 300));
+    // eslint-disable-next-line @typescript-eslint/no-explicit-any
+    const infoMap = (mapper as any).infoMap;
+    // Alternating lookups repeatedly evict and re-load each entry; every
+    // key should reuse its spill file rather than writing a fresh one.
+    for (let i = 0; i < 10; i++) {
+      infoMap.get('a.js');
+      infoMap.get('b.js');
+      infoMap.get('c.js');
+    }
+    assert.ok(fs.readdirSync(infoMap.spillDir).length <= 3);
+  });
+  it('should leave a mapper with unexpected internals untouched', () => {
+    const mapper = ({notInfoMap: true} as unknown) as SourceMapper;
+    assert.strictEqual(false, applySourceMapMemoryCap(mapper, 1024));
+  });
+});